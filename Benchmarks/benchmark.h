@@ -0,0 +1,39 @@
+//
+// Created by Aryan Singh on 6/25/24.
+//
+
+#ifndef GRAPHICA_BENCHMARK_H
+#define GRAPHICA_BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// Shared timing for the benchmark executables. Each kernel is run `repeats` times and the fastest
+// run is reported, which is the least disturbed by whatever else the machine is doing.
+template <typename F>
+double best_of_ms(int repeats, F&& run) {
+    double best = 1e300;
+    for (int i = 0; i < repeats; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto stop = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(stop - start).count());
+    }
+    return best;
+}
+
+// One line per kernel: name, fastest time, and the time per operation.
+inline void report(const char* name, double ms, double operations) {
+    std::printf("%-40s %10.3f ms %10.3f ns/op\n", name, ms, ms * 1e6 / operations);
+}
+
+// Keeps the optimiser from discarding work whose result nobody reads: each kernel folds what it
+// computes into one number and hands it here.
+inline volatile double benchmark_sink;
+
+inline void keep(double value) {
+    benchmark_sink = value;
+}
+
+#endif //GRAPHICA_BENCHMARK_H
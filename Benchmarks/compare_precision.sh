@@ -0,0 +1,49 @@
+#!/bin/sh
+# Renders every scene of main.cpp with the double (Graphica) and the float (Graphica_float) build
+# and reports, per scene, the render time of each and how far the float image is from the double
+# one: the RMS difference per channel, and the shift of the mean brightness in percent. Renders
+# are noisy and the two builds' paths soon draw different random numbers, so the double build is
+# also rendered with another seed; its differences are the Monte Carlo noise at this sample count,
+# and only what the float build adds above them is precision error.
+#
+# usage: Benchmarks/compare_precision.sh [image_width] [samples_per_pixel] [build_dir]
+# Run from the repository root, where the scenes find ./image_textures.
+set -e
+
+width=${1:-200}
+samples=${2:-32}
+build=${3:-build-compare}
+scenes=$(grep -o 'case [0-9]*:' Main_Classes/main.cpp | grep -o '[0-9]*')
+
+cmake -S . -B "$build" -DCMAKE_BUILD_TYPE=Release > /dev/null
+cmake --build "$build" --target Graphica Graphica_float > /dev/null
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+# RMS difference of two P3 images over all channels, on the 0-255 scale, and the shift of the
+# second image's mean from the first's, in percent
+compare() {
+    awk 'FNR == 1 { file++; n = 0 }
+         { for (i = 1; i <= NF; i++) { n++; if (n <= 4) continue;
+               if (file == 1) { a[n] = $i; first += $i }
+               else { d = $i - a[n]; sum += d * d; second += $i; count++ } } }
+         END { printf "%8.2f %+8.2f", sqrt(sum / count), (first > 0 ? 100 * (second - first) / first : 0) }' "$1" "$2"
+}
+
+# renders scene $2 with binary $1 and seed $3 into $4.ppm and prints the render time in ms
+render() {
+    "$1" "$2" "$width" "$samples" "$3" > "$4.ppm" 2> "$4.log"
+    grep -o 'Rendering time: [0-9]*' "$4.log" | grep -o '[0-9]*$'
+}
+
+printf "%-6s %10s %10s %8s   %-17s   %-17s\n" "" double float "" "float vs double" "double, new seed"
+printf "%-6s %10s %10s %8s   %8s %8s   %8s %8s\n" scene ms ms speedup rmse "mean %" rmse "mean %"
+for scene in $scenes; do
+    double_ms=$(render "$build/Graphica" "$scene" 1 "$out/double")
+    float_ms=$(render "$build/Graphica_float" "$scene" 1 "$out/float")
+    render "$build/Graphica" "$scene" 2 "$out/reseeded" > /dev/null
+    speedup=$(echo "$double_ms $float_ms" | awk '{ printf "%.2f", ($2 > 0 ? $1 / $2 : 0) }')
+    printf "%-6s %10s %10s %8s   %s   %s\n" "$scene" "$double_ms" "$float_ms" "$speedup" \
+        "$(compare "$out/double.ppm" "$out/float.ppm")" "$(compare "$out/double.ppm" "$out/reseeded.ppm")"
+done
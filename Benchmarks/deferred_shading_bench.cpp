@@ -0,0 +1,115 @@
+//
+// Created by Aryan Singh on 6/25/24.
+//
+
+// What deferring the surface interaction saves. The same sphere scenes are traced twice: once
+// filling in the full surface (position, normal, the acos / atan2 uv and the material) for every
+// candidate a primitive reports, as hit() did before, and once only for the closest hit, through
+// resolve_surface(). Both count their surface evaluations.
+
+#include "Header_Files/constants.h"
+#include "Header_Files/sphere.h"
+#include "Header_Files/entity_list.h"
+#include "Header_Files/bvh.h"
+#include "Header_Files/material.h"
+#include "Benchmarks/benchmark.h"
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+long surface_evaluations = 0;
+
+// A primitive as hit() used to work: shades every candidate it reports straight away.
+class shade_every_candidate : public entity {
+public:
+    explicit shade_every_candidate(shared_ptr<entity> object) : object(std::move(object)) {}
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        if (!object->hit(r, ray_t, rec)) {
+            return false;
+        }
+        object->surface_interaction(r, rec);
+        surface_evaluations++;
+        return true;
+    }
+
+    void surface_interaction(const ray& r, entity_record& rec) const override {}
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return object->bounding_box();
+    }
+
+private:
+    shared_ptr<entity> object;
+};
+
+point3 random_point(double size) {
+    return point3(size * (random_double() - 0.5), size * (random_double() - 0.5), size * (random_double() - 0.5));
+}
+
+} // namespace
+
+int main() {
+    SeedRng(7);
+    const int repeats = 5;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+
+    for (int count : {16, 256, 4096}) {
+        entity_list deferred, eager;
+        for (int i = 0; i < count; i++) {
+            auto s = make_shared<sphere>(random_point(10), 0.1 + 0.4 * random_double(), white);
+            deferred.add(s);
+            eager.add(make_shared<shade_every_candidate>(s));
+        }
+        // small scenes as a flat list, the way a BVH leaf or a short entity_list sees them
+        shared_ptr<entity> deferred_scene, eager_scene;
+        if (count <= 16) {
+            deferred_scene = make_shared<entity_list>(deferred);
+            eager_scene = make_shared<entity_list>(eager);
+        } else {
+            deferred_scene = make_shared<bvh>(deferred);
+            eager_scene = make_shared<bvh>(eager);
+        }
+
+        vector<ray> rays;
+        const int ray_count = 1 << 17;
+        for (int i = 0; i < ray_count; i++) {
+            auto origin = random_point(20);
+            rays.emplace_back(origin, random_point(6) - origin);
+        }
+
+        long eager_evaluations = 0, deferred_evaluations = 0;
+        auto eager_ms = best_of_ms(repeats, [&] {
+            surface_evaluations = 0;
+            double sum = 0;
+            for (const auto& r : rays) {
+                entity_record rec;
+                if (eager_scene->hit(r, interval(0.001, inf), rec)) {
+                    sum += rec.u;
+                }
+            }
+            eager_evaluations = surface_evaluations;
+            keep(sum);
+        });
+        auto deferred_ms = best_of_ms(repeats, [&] {
+            deferred_evaluations = 0;
+            double sum = 0;
+            for (const auto& r : rays) {
+                entity_record rec;
+                if (deferred_scene->hit(r, interval(0.001, inf), rec)) {
+                    resolve_surface(r, rec);
+                    deferred_evaluations++;
+                    sum += rec.u;
+                }
+            }
+            keep(sum);
+        });
+
+        printf("%d spheres, %d rays: %ld surface evaluations shading every candidate, %ld deferred\n",
+               count, ray_count, eager_evaluations, deferred_evaluations);
+        report("  shade every candidate", eager_ms, ray_count);
+        report("  deferred to the closest hit", deferred_ms, ray_count);
+    }
+}
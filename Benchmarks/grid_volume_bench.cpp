@@ -0,0 +1,180 @@
+//
+// Created by Aryan Singh on 6/25/24.
+//
+
+// grid_volume on the smoke plume of cornell_grid_smoke (scene 10 of main.cpp), with rays from that
+// scene's camera and from its ceiling light. Free-path sampling through the per-brick majorants is
+// timed against delta tracking with one majorant for the whole box, which is what the volume would
+// do without its majorant grid; that baseline also counts its density lookups. The fraction of
+// rays that collide should agree between the two to within noise. Ratio tracking transmittance
+// and dense storage are timed as well. Whole-scene render times of scene 10 are printed by
+// Benchmarks/compare_precision.sh.
+
+#include "Header_Files/constants.h"
+#include "Header_Files/grid_volume.h"
+#include "Header_Files/perlin.h"
+#include "Benchmarks/benchmark.h"
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const int resolution = 128;
+const double density_scale = 0.05;
+const axis_aligned_bounding_box region(point3(60,0,60), point3(495,540,495));
+
+// the plume of cornell_grid_smoke: rising from the floor, widening with height, broken up by
+// turbulence, and empty over most of its box
+vector<float> smoke_plume() {
+    perlin noise;
+    vector<float> densities(size_t(resolution) * resolution * resolution);
+    vector<point3> row(resolution);
+    vector<double> turbulence(resolution);
+    for (int k = 0; k < resolution; k++) {
+        for (int j = 0; j < resolution; j++) {
+            auto y = double(j) / (resolution - 1);
+            auto z = double(k) / (resolution - 1) - 0.5;
+            for (int i = 0; i < resolution; i++) {
+                row[i] = point3(i, j, k) * (6.0 / resolution);
+            }
+            noise.turbulence(row.data(), turbulence.data(), resolution, 5);
+            for (int i = 0; i < resolution; i++) {
+                auto x = double(i) / (resolution - 1) - 0.5;
+                auto radius = 0.12 + 0.3 * y;
+                auto falloff = 1 - (x * x + z * z) / (radius * radius);
+                auto density = falloff > 0 ? falloff * (0.2 + 2 * turbulence[i]) * (1 - y) : 0.0;
+                densities[(size_t(k) * resolution + j) * resolution + i] = float(density);
+            }
+        }
+    }
+    return densities;
+}
+
+long density_lookups = 0;
+
+// Woodcock tracking against the largest density anywhere in the box, through the volume's public
+// density(): a tentative collision every 1 / majorant along the whole clipped ray.
+bool single_majorant_hit(const grid_volume& volume, double majorant, const ray& r, interval ray_t, double& hit_t) {
+    for (int a = 0; a < 3; a++) {
+        auto inverse = 1 / r.direction()[a];
+        auto t0 = (region.axis_of_interval(a).min - r.origin()[a]) * inverse;
+        auto t1 = (region.axis_of_interval(a).max - r.origin()[a]) * inverse;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        ray_t.min = fmax(ray_t.min, t0);
+        ray_t.max = fmin(ray_t.max, t1);
+    }
+    auto scale = density_scale * r.direction().length();
+    auto t = ray_t.min;
+    while (true) {
+        t -= log(1 - random_double()) / (majorant * scale);
+        if (t >= ray_t.max) {
+            return false;
+        }
+        density_lookups++;
+        if (random_double() * majorant < volume.density(r.at(t))) {
+            hit_t = t;
+            return true;
+        }
+    }
+}
+
+// primary rays of the scene's 40 degree camera, one per pixel of a width x width image
+vector<ray> camera_rays(int width) {
+    vector<ray> rays;
+    auto h = tan(deg_to_rad(20.0));
+    for (int j = 0; j < width; j++) {
+        for (int i = 0; i < width; i++) {
+            auto x = (2 * (i + random_double()) / width - 1) * h;
+            auto y = (1 - 2 * (j + random_double()) / width) * h;
+            rays.emplace_back(point3(278,278,-800), vec3(x, y, 1));
+        }
+    }
+    return rays;
+}
+
+// rays leaving the ceiling light downwards in random directions
+vector<ray> light_rays(int count) {
+    vector<ray> rays;
+    for (int i = 0; i < count; i++) {
+        auto origin = point3(113 + 330 * random_double(), 554, 127 + 305 * random_double());
+        auto direction = random_unit_vector();
+        rays.emplace_back(origin, vec3(direction.x(), -fabs(direction.y()), direction.z()));
+    }
+    return rays;
+}
+
+} // namespace
+
+int main() {
+    SeedRng(7);
+    const int repeats = 5;
+    auto densities = smoke_plume();
+    double largest = 0;
+    for (auto d : densities) {
+        largest = fmax(largest, d);
+    }
+    grid_volume sparse(region, resolution, resolution, resolution, densities, density_scale, color(0.9, 0.9, 0.9));
+    grid_volume dense(region, resolution, resolution, resolution, densities, density_scale, color(0.9, 0.9, 0.9),
+                      grid_volume::storage::dense);
+
+    struct ray_set {
+        const char* name;
+        vector<ray> rays;
+    };
+    for (const auto& set : {ray_set{"camera rays", camera_rays(256)}, ray_set{"light rays", light_rays(1 << 16)}}) {
+        const auto& rays = set.rays;
+        int single_hits = 0, brick_hits = 0;
+        long single_lookups = 0;
+        auto single_ms = best_of_ms(repeats, [&] {
+            single_hits = 0;
+            density_lookups = 0;
+            double sum = 0;
+            for (const auto& r : rays) {
+                double t;
+                if (single_majorant_hit(sparse, largest, r, interval(0.001, inf), t)) {
+                    single_hits++;
+                    sum += t;
+                }
+            }
+            single_lookups = density_lookups;
+            keep(sum);
+        });
+        auto tracking = [&](const grid_volume& volume, int& hits) {
+            return best_of_ms(repeats, [&] {
+                hits = 0;
+                double sum = 0;
+                for (const auto& r : rays) {
+                    entity_record rec;
+                    if (volume.hit(r, interval(0.001, inf), rec)) {
+                        hits++;
+                        sum += rec.t;
+                    }
+                }
+                keep(sum);
+            });
+        };
+        int dense_hits = 0;
+        auto brick_ms = tracking(sparse, brick_hits);
+        auto dense_ms = tracking(dense, dense_hits);
+        double transmitted = 0;
+        auto ratio_ms = best_of_ms(repeats, [&] {
+            transmitted = 0;
+            for (const auto& r : rays) {
+                transmitted += sparse.transmittance(r, interval(0.001, inf));
+            }
+            keep(transmitted);
+        });
+
+        auto count = double(rays.size());
+        printf("%s, %zu: collide %.4f with one majorant (%.1f lookups per ray), %.4f with brick majorants;"
+               " ratio tracking transmits %.4f\n", set.name, rays.size(), single_hits / count, single_lookups / count,
+               brick_hits / count, transmitted / count);
+        report("  delta tracking, one majorant", single_ms, count);
+        report("  delta tracking, brick majorants", brick_ms, count);
+        report("  delta tracking, dense storage", dense_ms, count);
+        report("  ratio tracking transmittance", ratio_ms, count);
+    }
+}
@@ -0,0 +1,168 @@
+//
+// Created by Aryan Singh on 6/25/24.
+//
+
+// The 4-wide watertight kernel of triangle_soa against the per-triangle test pyramid and
+// triangular_prism used before it: closest hit over a cloud of triangles, and rays aimed at the
+// shared edges and vertices of a mesh, where the old test could let a ray through.
+
+#include "Header_Files/constants.h"
+#include "Header_Files/triangle_soa.h"
+#include "Benchmarks/benchmark.h"
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct triangle {
+    point3 v0, v1, v2;
+};
+
+// pyramid::rayTriangleIntersect as it was: plane hit in float, then an inside test of three cross
+// products against the unnormalised normal.
+bool per_triangle_intersect(const vec3& orig, const vec3& dir,
+                            const vec3& v0, const vec3& v1, const vec3& v2, float& t) {
+    vec3 v0v1 = v1 - v0;
+    vec3 v0v2 = v2 - v0;
+    vec3 N = cross(v0v1, v0v2);
+
+    float NdotRayDirection = dot(N, dir);
+    if (fabs(NdotRayDirection) < 1e-8)
+        return false;
+
+    float d = -dot(N, v0);
+    t = -(dot(N, orig) + d) / NdotRayDirection;
+    if (t < 0) return false;
+
+    vec3 P = orig + t * dir;
+    vec3 C;
+
+    C = cross(v1 - v0, P - v0);
+    if (dot(N, C) < 0) return false;
+    C = cross(v2 - v1, P - v1);
+    if (dot(N, C) < 0) return false;
+    C = cross(v0 - v2, P - v2);
+    if (dot(N, C) < 0) return false;
+
+    return true;
+}
+
+bool per_triangle_closest(const vector<triangle>& triangles, const ray& r, interval ray_t, double& closest) {
+    bool hit_anything = false;
+    closest = ray_t.max;
+    for (const auto& tri : triangles) {
+        float t;
+        if (per_triangle_intersect(r.origin(), r.direction(), tri.v0, tri.v1, tri.v2, t)
+            && t < closest && t > ray_t.min) {
+            closest = t;
+            hit_anything = true;
+        }
+    }
+    return hit_anything;
+}
+
+point3 random_point(double size) {
+    return point3(size * (random_double() - 0.5), size * (random_double() - 0.5), size * (random_double() - 0.5));
+}
+
+} // namespace
+
+int main() {
+    SeedRng(7);
+    const int repeats = 5;
+
+    // a cloud of small triangles, tested exhaustively as a BVH leaf would
+    for (int count : {4, 16, 64}) {
+        vector<triangle> triangles;
+        triangle_soa soa;
+        for (int i = 0; i < count; i++) {
+            auto center = random_point(4);
+            triangle tri{center + random_point(1), center + random_point(1), center + random_point(1)};
+            triangles.push_back(tri);
+            soa.add(tri.v0, tri.v1, tri.v2);
+        }
+        vector<ray> rays;
+        const int ray_count = 1 << 17;
+        for (int i = 0; i < ray_count; i++) {
+            auto origin = random_point(12);
+            rays.emplace_back(origin, random_point(3) - origin);
+        }
+
+        int per_triangle_hits = 0, soa_hits = 0;
+        auto per_triangle_ms = best_of_ms(repeats, [&] {
+            per_triangle_hits = 0;
+            double sum = 0;
+            for (const auto& r : rays) {
+                double t;
+                if (per_triangle_closest(triangles, r, interval(0.001, inf), t)) {
+                    per_triangle_hits++;
+                    sum += t;
+                }
+            }
+            keep(sum);
+        });
+        auto soa_ms = best_of_ms(repeats, [&] {
+            soa_hits = 0;
+            double sum = 0;
+            for (const auto& r : rays) {
+                triangle_hit hit;
+                if (soa.hit(r, interval(0.001, inf), hit)) {
+                    soa_hits++;
+                    sum += hit.t;
+                }
+            }
+            keep(sum);
+        });
+
+        printf("%d triangles, %d rays: %d / %d hits\n", count, ray_count, per_triangle_hits, soa_hits);
+        report("  per-triangle (old)", per_triangle_ms, double(ray_count) * count);
+        report("  triangle_soa, 4 wide", soa_ms, double(ray_count) * count);
+    }
+
+    // A jittered 64x64 grid of quads, two triangles each, tilted out of the axis planes. Rays come
+    // from random points above and aim exactly at grid vertices and edge midpoints; every one of
+    // them should hit.
+    {
+        const int n = 64;
+        vector<point3> corners;
+        for (int i = 0; i <= n; i++) {
+            for (int j = 0; j <= n; j++) {
+                corners.emplace_back(i + 0.3 * random_double(), j + 0.3 * random_double(),
+                                     0.37 * i + 0.21 * j + 0.5 * random_double());
+            }
+        }
+        auto corner = [&](int i, int j) {
+            return corners[size_t(i) * (n + 1) + j];
+        };
+        vector<triangle> triangles;
+        triangle_soa soa;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                triangle a{corner(i, j), corner(i + 1, j), corner(i + 1, j + 1)};
+                triangle b{corner(i, j), corner(i + 1, j + 1), corner(i, j + 1)};
+                for (const auto& tri : {a, b}) {
+                    triangles.push_back(tri);
+                    soa.add(tri.v0, tri.v1, tri.v2);
+                }
+            }
+        }
+        int aimed = 0, per_triangle_misses = 0, soa_misses = 0;
+        for (int k = 0; k < 4096; k++) {
+            int i = 1 + int(random_double() * (n - 2)), j = 1 + int(random_double() * (n - 2));
+            point3 targets[] = {corner(i, j), 0.5 * (corner(i, j) + corner(i + 1, j)),
+                                0.5 * (corner(i, j) + corner(i + 1, j + 1))};
+            for (const auto& target : targets) {
+                auto origin = target + vec3(20 * (random_double() - 0.5), 20 * (random_double() - 0.5), 30);
+                ray r(origin, target - origin);
+                double t;
+                triangle_hit hit;
+                aimed++;
+                per_triangle_misses += !per_triangle_closest(triangles, r, interval(0.001, inf), t);
+                soa_misses += !soa.hit(r, interval(0.001, inf), hit);
+            }
+        }
+        printf("rays at shared edges and vertices: %d, missed by per-triangle %d, by triangle_soa %d\n",
+               aimed, per_triangle_misses, soa_misses);
+    }
+}
@@ -0,0 +1,80 @@
+//
+// Created by Aryan Singh on 6/25/24.
+//
+
+// The vec3 kernels one at a time, in double and in float, over arrays of random vectors small
+// enough to stay in cache. Built twice: Graphica_bench_vec3 with the scalar backend and
+// Graphica_bench_vec3_simd with GRAPHICA_SIMD_VEC3, so the two lists of timings line up.
+
+#include "Header_Files/constants.h"
+#include "Benchmarks/benchmark.h"
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const int count = 4096;
+const int passes = 500;
+const int repeats = 5;
+
+// Runs kernel(i) for every index, `passes` times over, and reports it.
+template <typename F>
+void time_kernel(const char* name, F&& kernel) {
+    auto ms = best_of_ms(repeats, [&] {
+        for (int pass = 0; pass < passes; pass++) {
+            for (int i = 0; i < count; i++) {
+                kernel(i);
+            }
+        }
+    });
+    report(name, ms, double(count) * passes);
+}
+
+template <typename T>
+void run(const char* precision) {
+    using v3 = vec3_t<T>;
+    vector<v3> a(count), b(count), out(count);
+    vector<T> scalars(count), scalar_out(count);
+    for (int i = 0; i < count; i++) {
+        a[i] = v3(T(random_double(-1, 1)), T(random_double(-1, 1)), T(random_double(-1, 1)));
+        b[i] = v3(T(random_double(-1, 1)), T(random_double(-1, 1)), T(random_double(-1, 1)));
+        scalars[i] = T(random_double(0.5, 2));
+    }
+    // folds the outputs into the sink once a kernel is done, so none of its stores are dead
+    auto drain = [&] {
+        double sum = 0;
+        for (int i = 0; i < count; i++) {
+            sum += out[i][0] + out[i][1] + out[i][2] + scalar_out[i];
+        }
+        keep(sum);
+    };
+
+    printf("%s\n", precision);
+    time_kernel("  u + v", [&](int i) { out[i] = a[i] + b[i]; });
+    time_kernel("  u - v", [&](int i) { out[i] = a[i] - b[i]; });
+    time_kernel("  u * v", [&](int i) { out[i] = a[i] * b[i]; });
+    time_kernel("  t * v", [&](int i) { out[i] = scalars[i] * a[i]; });
+    time_kernel("  v / t", [&](int i) { out[i] = a[i] / scalars[i]; });
+    time_kernel("  dot", [&](int i) { scalar_out[i] = dot(a[i], b[i]); });
+    time_kernel("  cross", [&](int i) { out[i] = cross(a[i], b[i]); });
+    time_kernel("  length", [&](int i) { scalar_out[i] = a[i].length(); });
+    time_kernel("  unit_vector", [&](int i) { out[i] = unit_vector(a[i]); });
+    time_kernel("  reflect", [&](int i) { out[i] = a[i] - 2 * dot(a[i], b[i]) * b[i]; });
+    drain();
+}
+
+} // namespace
+
+int main() {
+    SeedRng(7);
+#if defined(GRAPHICA_VEC3_PACKED) && defined(GRAPHICA_SIMD_AVX)
+    printf("vec3 backend: packed, AVX\n");
+#elif defined(GRAPHICA_VEC3_PACKED)
+    printf("vec3 backend: packed, SSE2\n");
+#else
+    printf("vec3 backend: scalar\n");
+#endif
+    run<double>("double");
+    run<float>("float");
+}
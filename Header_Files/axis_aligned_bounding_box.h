@@ -7,26 +7,30 @@
 
 #include "constants.h"
 
-class axis_aligned_bounding_box {
+template <typename T>
+class axis_aligned_bounding_box_t {
 public:
+    using interval = interval_t<T>;
+    using point3 = vec3_t<T>;
+
     interval x,y,z;
 
-    axis_aligned_bounding_box() {};
+    axis_aligned_bounding_box_t() {};
 
-    axis_aligned_bounding_box(const interval& x, const interval& y, const interval &z): x(x), y(y), z(z) {
+    axis_aligned_bounding_box_t(const interval& x, const interval& y, const interval &z): x(x), y(y), z(z) {
         pad_to_min();
     }
 
     // apparently fmin and fmax are slower than simple conditional???
     // https://stackoverflow.com/questions/76387817/fmin-and-fmax-are-much-slower-than-simple-conditional-operator
-    axis_aligned_bounding_box(const point3& a, const point3& b) {
+    axis_aligned_bounding_box_t(const point3& a, const point3& b) {
         x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
         y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
         z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
         pad_to_min();
     }
 
-    axis_aligned_bounding_box(const axis_aligned_bounding_box& box1, const axis_aligned_bounding_box& box2) {
+    axis_aligned_bounding_box_t(const axis_aligned_bounding_box_t& box1, const axis_aligned_bounding_box_t& box2) {
         x = interval(box1.x, box2.x);
         y = interval(box1.y, box2.y);
         z = interval(box1.z, box2.z);
@@ -42,12 +46,12 @@ public:
         }
     }
 
-    bool hit(const ray& r, interval ray) const {
+    bool hit(const ray_t<T>& r, interval ray) const {
         const point3& origin = r.origin();
-        const vec3& direction = r.direction();
+        const point3& direction = r.direction();
         for (int a = 0; a < 3; a++) {
             const interval& axis = axis_of_interval(a);
-            const double inverse = 1.0 / direction[a];
+            const T inverse = 1 / direction[a];
 
             auto t0 = (axis.min - origin[a]) * inverse;
             auto t1 = (axis.max - origin[a]) * inverse;
@@ -92,10 +96,10 @@ public:
         }
     }
 
-    static const axis_aligned_bounding_box empty, universe;
+    static const axis_aligned_bounding_box_t empty, universe;
 private:
     void pad_to_min() {
-        double epsilon = 0.0001;
+        T epsilon = 0.0001;
         if (x.size() < epsilon) {
             x = x.pad(epsilon);
         }
@@ -108,13 +112,21 @@ private:
     }
 };
 
-const axis_aligned_bounding_box axis_aligned_bounding_box::empty = axis_aligned_bounding_box(interval::empty, interval::empty, interval::empty);
-const axis_aligned_bounding_box axis_aligned_bounding_box::universe = axis_aligned_bounding_box(interval::universe, interval::universe, interval::universe);
+template <typename T>
+const axis_aligned_bounding_box_t<T> axis_aligned_bounding_box_t<T>::empty =
+        axis_aligned_bounding_box_t<T>(interval_t<T>::empty, interval_t<T>::empty, interval_t<T>::empty);
+template <typename T>
+const axis_aligned_bounding_box_t<T> axis_aligned_bounding_box_t<T>::universe =
+        axis_aligned_bounding_box_t<T>(interval_t<T>::universe, interval_t<T>::universe, interval_t<T>::universe);
+
+using axis_aligned_bounding_box = axis_aligned_bounding_box_t<real>;
 
-axis_aligned_bounding_box operator+(const axis_aligned_bounding_box& box, const vec3& offset) {
-    return axis_aligned_bounding_box(box.x + offset.x(), box.y + offset.y(), box.z + offset.z());
+template <typename T>
+axis_aligned_bounding_box_t<T> operator+(const axis_aligned_bounding_box_t<T>& box, const vec3_t<T>& offset) {
+    return axis_aligned_bounding_box_t<T>(box.x + offset.x(), box.y + offset.y(), box.z + offset.z());
 }
-axis_aligned_bounding_box operator+(const vec3& offset, const axis_aligned_bounding_box& box) {
+template <typename T>
+axis_aligned_bounding_box_t<T> operator+(const vec3_t<T>& offset, const axis_aligned_bounding_box_t<T>& box) {
     return box + offset;
 }
 #endif //GRAPHICA_AXIS_ALIGNED_BOUNDING_BOX_H
@@ -0,0 +1,150 @@
+//
+// Created by Aryan Singh on 6/19/24.
+//
+
+#ifndef GRAPHICA_BAKED_TEXTURE_H
+#define GRAPHICA_BAKED_TEXTURE_H
+
+#include "constants.h"
+#include "texture.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Solid texture sampled once on a 3D grid over a region and looked up with trilinear
+// interpolation afterwards. This is meant for expensive procedural textures such as noise_texture,
+// whose turbulence costs seven octaves of Perlin noise per evaluation. The source is only evaluated
+// at grid points (with u = v = 0, so it must depend on p alone) and outside the region, where it
+// is used directly.
+//
+// The grid is stored in 4x4x4 bricks, so the eight corners of a lookup usually share a cache line
+// or two rather than spanning three planes of the whole grid. Detail finer than the grid spacing is
+// lost; the constructor measures how much by comparing against the source at a fixed set of points
+// and reports the largest and the RMS difference.
+class baked_texture : public texture {
+public:
+    static const int brick_size = 4;
+
+    // resolution is the number of grid cells along the longest side of region; the other sides get
+    // cells of about the same size.
+    baked_texture(shared_ptr<texture> source, const axis_aligned_bounding_box& region, int resolution)
+            : source(std::move(source)) {
+        origin = point3(region.x.min, region.y.min, region.z.min);
+        vec3 extent(region.x.size(), region.y.size(), region.z.size());
+        auto longest = fmax(extent.x(), fmax(extent.y(), extent.z()));
+        resolution = std::max(resolution, 1);
+        for (int a = 0; a < 3; a++) {
+            int cells = std::max(1, int(ceil(resolution * extent[a] / longest)));
+            points[a] = cells + 1;
+            bricks[a] = (points[a] + brick_size - 1) / brick_size;
+            spacing[a] = extent[a] / cells;
+            inverse_spacing[a] = spacing[a] > 0 ? 1 / spacing[a] : 0;
+        }
+        texels.resize(size_t(bricks[0]) * bricks[1] * bricks[2] * brick_size * brick_size * brick_size * 3);
+        bake();
+        measure_error();
+
+        std::clog << "Baked texture: " << points[0] << "x" << points[1] << "x" << points[2] << " points, "
+                  << texels.size() * sizeof(float) / (1024.0 * 1024.0) << " MiB, max error " << max_difference
+                  << ", rms error " << rms_difference << "\n";
+    }
+
+    color value(double u, double v, const point3& p) const override {
+        real x = (p.x() - origin.x()) * inverse_spacing.x();
+        real y = (p.y() - origin.y()) * inverse_spacing.y();
+        real z = (p.z() - origin.z()) * inverse_spacing.z();
+        if (!(x >= 0 && y >= 0 && z >= 0 && x <= points[0] - 1 && y <= points[1] - 1 && z <= points[2] - 1)) {
+            return source->value(u, v, p);
+        }
+
+        // every axis has at least two points; the last cell also takes the far boundary
+        int i = std::min(int(x), points[0] - 2);
+        int j = std::min(int(y), points[1] - 2);
+        int k = std::min(int(z), points[2] - 2);
+        real fx = x - i, fy = y - j, fz = z - k;
+        int i1 = i + 1, j1 = j + 1, k1 = k + 1;
+
+        auto lerp = [](const color& a, const color& b, real t) { return a + t * (b - a); };
+        auto near_plane = lerp(lerp(texel(i, j, k), texel(i1, j, k), fx), lerp(texel(i, j1, k), texel(i1, j1, k), fx), fy);
+        auto far_plane = lerp(lerp(texel(i, j, k1), texel(i1, j, k1), fx), lerp(texel(i, j1, k1), texel(i1, j1, k1), fx), fy);
+        return lerp(near_plane, far_plane, fz);
+    }
+
+    // Largest and RMS per-channel difference from the source seen at the test points.
+    [[nodiscard]] double max_error() const { return max_difference; }
+    [[nodiscard]] double rms_error() const { return rms_difference; }
+
+private:
+    shared_ptr<texture> source;
+    point3 origin;
+    vec3 spacing, inverse_spacing;
+    int points[3];
+    int bricks[3];
+    std::vector<float> texels; // RGB, brick by brick
+    double max_difference = 0, rms_difference = 0;
+
+    size_t offset(int i, int j, int k) const {
+        size_t brick = (size_t(k / brick_size) * bricks[1] + j / brick_size) * bricks[0] + i / brick_size;
+        size_t inside = (size_t(k % brick_size) * brick_size + j % brick_size) * brick_size + i % brick_size;
+        return (brick * brick_size * brick_size * brick_size + inside) * 3;
+    }
+
+    color texel(int i, int j, int k) const {
+        const float* t = &texels[offset(i, j, k)];
+        return color(t[0], t[1], t[2]);
+    }
+
+    void bake() {
+        // planes of the grid are independent, so they are split over the hardware threads
+        int thread_count = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for (int t = 0; t < thread_count; t++) {
+            threads.emplace_back([this, t, thread_count] {
+                // one row of points at a time through the source's batched evaluation
+                std::vector<point3> row(points[0]);
+                std::vector<color> colors(points[0]);
+                for (int k = t; k < points[2]; k += thread_count) {
+                    for (int j = 0; j < points[1]; j++) {
+                        for (int i = 0; i < points[0]; i++) {
+                            row[i] = origin + vec3(i * spacing.x(), j * spacing.y(), k * spacing.z());
+                        }
+                        source->solid_values(row.data(), colors.data(), row.size());
+                        for (int i = 0; i < points[0]; i++) {
+                            float* out = &texels[offset(i, j, k)];
+                            out[0] = float(colors[i].x());
+                            out[1] = float(colors[i].y());
+                            out[2] = float(colors[i].z());
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Test points come from the R3 low-discrepancy sequence rather than random_double(), so baking
+    // does not change the random numbers the rest of the scene setup sees.
+    void measure_error() {
+        const int samples = 4096;
+        const double g = 1.22074408460575947536; // root of x^4 = x + 1
+        const double step[3] = {1 / g, 1 / (g * g), 1 / (g * g * g)};
+        double sum_squared = 0;
+        for (int s = 0; s < samples; s++) {
+            point3 p;
+            for (int a = 0; a < 3; a++) {
+                auto f = 0.5 + step[a] * (s + 1);
+                p[a] = origin[a] + (f - floor(f)) * spacing[a] * (points[a] - 1);
+            }
+            auto difference = value(0, 0, p) - source->value(0, 0, p);
+            for (int c = 0; c < 3; c++) {
+                max_difference = fmax(max_difference, fabs(difference[c]));
+                sum_squared += difference[c] * difference[c];
+            }
+        }
+        rms_difference = sqrt(sum_squared / (3 * samples));
+    }
+};
+
+#endif //GRAPHICA_BAKED_TEXTURE_H
@@ -54,6 +54,17 @@ public:
 
     axis_aligned_bounding_box bounding_box() const override { return bbox; }
 
+    void flatten(vector<const entity*>& leaves) const override {
+        left->flatten(leaves);
+        if (right != left) {
+            right->flatten(leaves);
+        }
+    }
+
+    [[nodiscard]] int instance_depth() const override {
+        return std::max(left->instance_depth(), right->instance_depth());
+    }
+
 private:
     shared_ptr<entity> left, right;
     axis_aligned_bounding_box bbox;
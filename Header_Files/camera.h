@@ -12,6 +12,13 @@
 #include "material.h"
 #include "bs_thread_pool.h"
 #include "sphere.h"
+#include "compiled_scene.h"
+#include "sampling.h"
+#include "medium.h"
+#include "environment_light.h"
+#include "light_tree.h"
+#include "splat_buffer.h"
+#include <cstring>
 #include <mutex>
 #include <thread>
 #include <future>
@@ -30,6 +37,26 @@ public:
     double DEFOCUS_ANGLE = 0;
     double FOCUS_DISTANCE = 10; // distance from camera to perfect focus
     color BACKGROUND;
+    // Medium filling the scene around every object, e.g. haze; nullptr for none. It needs no
+    // boundary geometry: it spans the scene's bounding box, and rays leaving that box reach the
+    // background unattenuated.
+    shared_ptr<medium> GLOBAL_MEDIUM;
+    // Light from infinitely far away, seen by rays that leave the scene in place of BACKGROUND
+    // and sampled directly at every diffuse or rough surface and medium scattering event.
+    shared_ptr<environment_light> ENVIRONMENT;
+    // Direct lighting at the first surface each camera ray meets by spatiotemporal reservoir
+    // resampling (ReSTIR) instead of one light sample per pixel sample; see render_reservoirs().
+    // Reservoirs hold no transmittance, so a camera inside a medium (GLOBAL_MEDIUM included)
+    // renders without them, with a warning.
+    bool RESTIR_DIRECT = false;
+    int RESTIR_CANDIDATES = 16; // light samples drawn per pixel and pass
+    int RESTIR_NEIGHBOURS = 4; // pixels each pixel reuses reservoirs from, at most 15
+    int RESTIR_RADIUS = 12; // how far away, in pixels, those may be
+    // Bidirectional path tracing instead of paths traced from the camera alone; see
+    // render_bidirectional(). Light that reaches diffuse surfaces through glass or off mirrors
+    // (caustics) is then found by paths leaving the lights. Needs lights to start those paths from,
+    // and replaces RESTIR_DIRECT.
+    bool BIDIRECTIONAL = false;
 
     struct ThreadInfo {
         int start_col;
@@ -73,9 +100,31 @@ public:
 //        std::clog << "Rendering time: " << elapsed_time.count() << " milliseconds\n";
 //    }
 
-    void render(const entity& world) {
+    // Renders with explicit connections to the scene's lights: the emitting spheres and flat
+    // shapes found in it are sampled through a light_tree. Light scattered by media is then
+    // gathered from every medium segment, and light reflected by surfaces that are not perfectly
+    // specular from one light sample per bounce, rather than found by chance. Emitters the tree
+    // cannot sample (moving spheres, lights inside instances) are still found by chance.
+    void render(const entity& authored_world) {
+        render_scene(authored_world, nullptr);
+    }
+
+    // Renders connecting to the given set of emitters instead (usually an entity_list of quads or
+    // spheres that are also in world), whose pdf_value() and random() sample them.
+    void render(const entity& authored_world, const entity& lights) {
+        render_scene(authored_world, &lights);
+    }
+
+private:
+    void render_scene(const entity& authored_world, const entity* lights) {
         auto start_time = std::chrono::high_resolution_clock::now();
         initialize();
+
+        // flatten the authored scene into the type-grouped render layout
+        compiled_scene world(authored_world);
+        scene_bounds = world.bounding_box();
+        light_set = lights ? lights : (world.lights().empty() ? nullptr : &world.lights());
+        camera_media = media_enclosing(world, POV_OF_CAMERA, GLOBAL_MEDIUM.get());
         std::cout << "P3\n" << IMAGE_WIDTH << " " << IMAGE_HEIGHT << "\n255\n";
 
         BS::thread_pool pool(std::thread::hardware_concurrency());
@@ -87,11 +136,20 @@ public:
 
         std::vector<std::future<void>> futures;
 
-        for (int j = 0; j < IMAGE_HEIGHT; j += block_size) {
-            for (int i = 0; i < IMAGE_WIDTH; i += block_size) {
-                futures.push_back(pool.submit_task([this, &world, &buffer, &completed, i, j, block_size]() {
-                    render_block(world, buffer, completed, i, j, block_size);
-                }));
+        if (RESTIR_DIRECT && !BIDIRECTIONAL && camera_media.current()) {
+            std::clog << "RESTIR_DIRECT ignored: the camera is inside a medium\n";
+        }
+        if (BIDIRECTIONAL && light_set) {
+            render_bidirectional(world, pool, buffer);
+        } else if (RESTIR_DIRECT && light_set && MAX_RECURSION_DEPTH > 1 && !camera_media.current()) {
+            render_reservoirs(world, pool, buffer);
+        } else {
+            for (int j = 0; j < IMAGE_HEIGHT; j += block_size) {
+                for (int i = 0; i < IMAGE_WIDTH; i += block_size) {
+                    futures.push_back(pool.submit_task([this, &world, &buffer, &completed, i, j, block_size]() {
+                        render_block(world, buffer, completed, i, j, block_size);
+                    }));
+                }
             }
         }
 
@@ -108,10 +166,9 @@ public:
         auto end_time = std::chrono::high_resolution_clock::now();
         auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
         std::clog << "Rendering time: " << elapsed_time.count() << " milliseconds\n";
+        image_store::report(std::clog);
     }
 
-
-private:
     int IMAGE_HEIGHT;
     point3 camera_center;
     point3 pixel_0_loc;
@@ -121,8 +178,12 @@ private:
     vec3 u, v, w; // basis vectors for camera plane
     vec3 disk_hr; // horizontal radius for defocus disk
     vec3 disk_vr; // vertical radius for defocus disk
+    double pixel_spread; // angle one pixel subtends, the spread of every camera ray cone
     int sqrt_samples_per_pixel;
     double recip_sqrt_samples_per_pixel;
+    medium_stack camera_media; // media enclosing the camera, where every camera path starts
+    axis_aligned_bounding_box scene_bounds;
+    const entity* light_set = nullptr; // lights to connect to, or nullptr to rely on chance alone
 
     void initialize() {
         IMAGE_HEIGHT = static_cast<int>(IMAGE_WIDTH / ASPECT_RATIO);
@@ -153,6 +214,7 @@ private:
         // calculating delta vectors
         pixel_delta_u = viewport_vector_u / IMAGE_WIDTH;
         pixel_delta_v = viewport_vector_v / IMAGE_HEIGHT;
+        pixel_spread = pixel_delta_v.length() / FOCUS_DISTANCE;
 
         // calculate location of pixel at (0,0)
         auto view_upper_left = camera_center - (FOCUS_DISTANCE * w) - viewport_vector_u / 2 - viewport_vector_v / 2;
@@ -172,7 +234,7 @@ private:
                 for (int s_i = 0; s_i < sqrt_samples_per_pixel; s_i++) {
                     for (int s_j = 0; s_j < sqrt_samples_per_pixel; s_j++) {
                         ray r = get_ray(i, j, s_i, s_j);
-                        pixel_color += ray_color(r, world, MAX_RECURSION_DEPTH);
+                        pixel_color += ray_color(r, world, MAX_RECURSION_DEPTH, camera_media);
                     }
                 }
                 std::ostringstream oss;
@@ -186,36 +248,1232 @@ private:
     }
 
 
-    color ray_color(const ray& r, const entity& world, int curr_depth) const {
+    // Point on a light, where it was sampled from and what it emits.
+    struct light_point {
+        point3 p;
+        vec3 normal;
+        color emitted;
+    };
+
+    // First surface a camera ray meets, kept per pixel for one pass of render_reservoirs(). Only
+    // surfaces that can be lit by light samples are kept; other pixels are rendered by ray_color().
+    struct surface_sample {
+        bool valid = false;
+        ray r; // the camera ray
+        entity_record rec;
+        double depth = 0;
+        ray scattered; // the bounce the path continues with, its weight and density
+        color change;
+        double material_pdf = 0;
+    };
+
+    // Weighted reservoir of light points (Bitterli et al., "Spatiotemporal Reservoir Resampling
+    // for Real-Time Ray Tracing with Dynamic Direct Lighting"). It keeps one of the candidates
+    // streamed through it with probability proportional to their weights; W, set once streaming
+    // ends, makes f(sample) * W an unbiased estimate of the integral of f over the lights.
+    struct reservoir {
+        light_point sample;
+        double weight_sum = 0;
+        double count = 0; // M, the candidates it stands for
+        double W = 0;
+
+        void add(const light_point& candidate, double weight, double m) {
+            weight_sum += weight;
+            count += m;
+            if (weight > 0 && random_double() * weight_sum < weight) {
+                sample = candidate;
+            }
+        }
+    };
+
+    // Progressive rendering with ReSTIR direct lighting. Each pass takes one sample per pixel, in
+    // the same stratified order as render_block(), and runs in two parallel sweeps:
+    //  1. trace the camera rays to a G-buffer of first surfaces, give each pixel a reservoir of
+    //     RESTIR_CANDIDATES light samples, and merge in the pixel's reservoir from the previous
+    //     pass (temporal reuse);
+    //  2. merge in the reservoirs of up to RESTIR_NEIGHBOURS similar pixels nearby (spatial reuse),
+    //     trace one visibility ray to the light point that survives and shade with it.
+    // Indirect light continues from the G-buffer with ray_color(), which skips the lights the
+    // reservoir already accounts for. Merges use the 1/Z normalisation, so reuse across surfaces
+    // that see the lights differently stays unbiased.
+    void render_reservoirs(const entity& world, BS::thread_pool& pool,
+                           std::vector<std::vector<std::array<char, 32>>>& buffer) const {
+        auto pixels = size_t(IMAGE_WIDTH) * IMAGE_HEIGHT;
+        std::vector<surface_sample> current(pixels), previous(pixels);
+        std::vector<reservoir> temporal(pixels), merged(pixels), history(pixels);
+        std::vector<color> sum(pixels, color(0,0,0));
+        auto passes = sqrt_samples_per_pixel * sqrt_samples_per_pixel;
+        auto history_cap = 20.0 * RESTIR_CANDIDATES; // the previous pass may not drown out this one
+
+        auto for_each_row = [&](auto&& row) {
+            std::vector<std::future<void>> rows;
+            for (int j = 0; j < IMAGE_HEIGHT; j++) {
+                rows.push_back(pool.submit_task([&row, j]() { row(j); }));
+            }
+            for (auto& future : rows) {
+                future.wait();
+            }
+        };
+
+        for (int pass = 0; pass < passes; pass++) {
+            auto s_i = pass / sqrt_samples_per_pixel;
+            auto s_j = pass % sqrt_samples_per_pixel;
+            for_each_row([&](int j) {
+                for (int i = 0; i < IMAGE_WIDTH; i++) {
+                    auto index = size_t(j) * IMAGE_WIDTH + i;
+                    auto& g = current[index];
+                    if (!first_surface(get_ray(i, j, s_i, s_j), world, g)) {
+                        sum[index] += ray_color(g.r, world, MAX_RECURSION_DEPTH, camera_media);
+                        temporal[index] = reservoir();
+                        continue;
+                    }
+                    reservoir initial;
+                    for (int c = 0; c < RESTIR_CANDIDATES; c++) {
+                        light_point light;
+                        double weight = 0;
+                        if (sample_light(g.rec.p, light)) {
+                            auto pdf = light_area_pdf(g.rec.p, light);
+                            weight = pdf > 0 ? reservoir_target(g, light) / pdf : 0;
+                        }
+                        initial.add(light, weight, 1);
+                    }
+                    finish_reservoir(initial, g, &g, initial.count);
+
+                    const reservoir* inputs[2] = {&initial, &history[index]};
+                    const surface_sample* domains[2] = {&g, &previous[index]};
+                    double counts[2] = {initial.count, fmin(history[index].count, history_cap)};
+                    temporal[index] = merge_reservoirs(g, inputs, domains, counts, previous[index].valid ? 2 : 1);
+                }
+            });
+            for_each_row([&](int j) {
+                const int max_neighbours = 15;
+                for (int i = 0; i < IMAGE_WIDTH; i++) {
+                    auto index = size_t(j) * IMAGE_WIDTH + i;
+                    const auto& g = current[index];
+                    if (!g.valid) {
+                        merged[index] = reservoir();
+                        continue;
+                    }
+                    const reservoir* inputs[max_neighbours + 1] = {&temporal[index]};
+                    const surface_sample* domains[max_neighbours + 1] = {&g};
+                    double counts[max_neighbours + 1] = {temporal[index].count};
+                    int n = 1;
+                    for (int k = 0; k < std::min(RESTIR_NEIGHBOURS, max_neighbours); k++) {
+                        auto q = sample_concentric_disk(random_double(), random_double()) * RESTIR_RADIUS;
+                        auto x = i + int(std::round(q.x())), y = j + int(std::round(q.y()));
+                        if (x < 0 || y < 0 || x >= IMAGE_WIDTH || y >= IMAGE_HEIGHT || (x == i && y == j)) {
+                            continue;
+                        }
+                        auto other = size_t(y) * IMAGE_WIDTH + x;
+                        const auto& h = current[other];
+                        // surfaces facing another way or at another depth see the lights too differently
+                        if (!h.valid || dot(h.rec.normal, g.rec.normal) < 0.9 || fabs(h.depth - g.depth) > 0.1 * g.depth) {
+                            continue;
+                        }
+                        inputs[n] = &temporal[other];
+                        domains[n] = &h;
+                        counts[n] = temporal[other].count;
+                        n++;
+                    }
+                    merged[index] = merge_reservoirs(g, inputs, domains, counts, n);
+                    sum[index] += shade_surface(g, merged[index], world);
+                }
+            });
+            std::swap(current, previous);
+            std::swap(merged, history);
+            std::clog << "\rPasses completed: " << pass + 1 << "/" << passes << std::flush;
+        }
+
+        for (int j = 0; j < IMAGE_HEIGHT; j++) {
+            for (int i = 0; i < IMAGE_WIDTH; i++) {
+                std::ostringstream oss;
+                write_color(oss, sum[size_t(j) * IMAGE_WIDTH + i] * sample_scale);
+                std::string pixel_str = oss.str();
+                std::copy(pixel_str.begin(), pixel_str.end(), buffer[j][i].begin());
+            }
+        }
+    }
+
+    // Traces camera ray r into g. Returns false when the pixel is left to ray_color(): the ray
+    // misses, crosses a medium boundary first, or meets an emitter or a specular surface.
+    bool first_surface(const ray& r, const entity& world, surface_sample& g) const {
+        g.valid = false;
+        g.r = r;
+        if (!world.hit(r, interval(0.001, inf), g.rec)) {
+            return false;
+        }
+        resolve_surface(r, g.rec);
+        if (g.rec.pass_through) {
+            return false;
+        }
+        auto width = set_footprint(r, g.rec);
+        if (!g.rec.materials->scatter(r, g.rec, g.change, g.scattered)) {
+            return false;
+        }
+        g.material_pdf = g.rec.materials->scattering_pdf(r, g.rec, g.scattered);
+        if (g.material_pdf <= 0) {
+            return false;
+        }
+        g.scattered = bounce(r, g.rec, g.scattered, width);
+        g.depth = g.rec.t * r.direction().length();
+        g.valid = true;
+        return true;
+    }
+
+    // Unshadowed light that light point `light` sends through g's surface towards the camera, per
+    // unit of light area, reduced to its luminance: the density reservoirs resample towards.
+    static double reservoir_target(const surface_sample& g, const light_point& light) {
+        auto to = light.p - g.rec.p;
+        auto distance_squared = to.length_squared();
+        if (distance_squared <= 0) {
+            return 0;
+        }
+        auto bsdf = g.rec.materials->scattering_bsdf(g.r, g.rec, ray(g.rec.p, to));
+        auto cosine_light = fabs(dot(light.normal, to)) / sqrt(distance_squared);
+        return luminance(bsdf * light.emitted) * cosine_light / distance_squared;
+    }
+
+    // Sets r.W for shading at g. The candidates behind r were drawn for the n domains given; only
+    // those that could have produced r.sample (target above zero there) count towards Z.
+    static void finish_reservoir(reservoir& r, const surface_sample& g, const surface_sample* const* domains,
+                                 const double* counts, int n) {
+        r.W = 0;
+        auto target = r.weight_sum > 0 ? reservoir_target(g, r.sample) : 0.0;
+        if (target <= 0) {
+            return;
+        }
+        double z = 0;
+        for (int d = 0; d < n; d++) {
+            if (domains[d] == &g || reservoir_target(*domains[d], r.sample) > 0) {
+                z += counts[d];
+            }
+        }
+        r.W = z > 0 ? r.weight_sum / (z * target) : 0;
+    }
+
+    static void finish_reservoir(reservoir& r, const surface_sample& g, const surface_sample* domain, double count) {
+        finish_reservoir(r, g, &domain, &count, 1);
+    }
+
+    // Resamples reservoirs made for the given domains into one for g, each weighted by how much g
+    // wants its sample.
+    static reservoir merge_reservoirs(const surface_sample& g, const reservoir* const* inputs,
+                                      const surface_sample* const* domains, const double* counts, int n) {
+        reservoir merged;
+        for (int d = 0; d < n; d++) {
+            const auto& input = *inputs[d];
+            auto weight = input.W > 0 ? reservoir_target(g, input.sample) * input.W * counts[d] : 0.0;
+            merged.add(input.sample, weight, counts[d]);
+        }
+        finish_reservoir(merged, g, domains, counts, n);
+        return merged;
+    }
+
+    // Everything g's pixel receives: the surface's own emission, direct light from the reservoir's
+    // light point through one visibility ray, the environment, and the rest of the path.
+    color shade_surface(const surface_sample& g, const reservoir& r, const entity& world) const {
+        const auto& rec = g.rec;
+        color total = rec.materials->emit(rec.u, rec.v, rec.p);
+        if (r.W > 0) {
+            auto to = r.sample.p - rec.p;
+            auto distance = to.length();
+            auto direction = to / distance;
+            auto from = offset_ray_origin(rec.p, rec.normal, direction);
+            auto media = camera_media;
+            if (rec.interior && dot(direction, rec.normal) < 0) {
+                media.cross(rec.interior, rec.front_face);
+            }
+            auto visible = shadow_transmittance(from, direction, (r.sample.p - from).length(), media, world);
+            if (visible > 0) {
+                auto bsdf = rec.materials->scattering_bsdf(g.r, rec, ray(rec.p, to));
+                auto cosine_light = fabs(dot(r.sample.normal, direction));
+                total += bsdf * r.sample.emitted * (cosine_light / (distance * distance) * visible * r.W);
+            }
+        }
+        if (ENVIRONMENT) {
+            total += environment_sample(g.r, rec, true, camera_media, world);
+        }
+        auto media = camera_media;
+        if (rec.interior && dot(g.scattered.direction(), rec.normal) < 0) {
+            media.cross(rec.interior, rec.front_face);
+        }
+        return total + g.change * ray_color(g.scattered, world, MAX_RECURSION_DEPTH - 1, media, g.material_pdf, true);
+    }
+
+    // Vertex of a subpath traced by render_bidirectional(), from the camera or from a light.
+    // Densities are per unit area at the vertex, or per unit volume for medium vertices, where the
+    // transmittance that free-flight sampling follows is left out of them.
+    struct path_vertex {
+        enum class kind : uint8_t { camera, light, surface, medium };
+        kind type = kind::surface;
+        entity_record rec; // p and normal; the material for every kind but the camera
+        ray arriving; // how the subpath reached the vertex
+        medium_stack media; // media on the side arriving came from
+        color beta; // throughput of the subpath up to the vertex
+        bool delta = false; // left specularly, or not at all, so no join can go through it
+        bool two_sided = false; // lights: emits from both faces
+        double pdf_forward = 0; // density of reaching the vertex along its own subpath
+        double pdf_reverse = 0; // the same, had the other subpath come the opposite way
+    };
+
+    // Bidirectional path tracing (Veach, "Robust Monte Carlo Methods for Light Transport
+    // Simulation", chapter 10). Every sample traces one subpath from the camera and one from a
+    // light chosen by power, then joins them in every way that gives a path of at most
+    // MAX_RECURSION_DEPTH segments: each prefix of one to each prefix of the other by a visibility
+    // ray, the camera subpath on its own when it meets an emitter, and the camera subpath to a
+    // light point chosen by the light set as in light_set_sample(). Each join is weighted by the
+    // balance heuristic over all the joins that could have produced the same path.
+    //
+    // Light subpaths joined to the camera land on whichever pixel they project to, so they are
+    // added to a splat_buffer that every thread shares; a pixel is the sum of its own samples'
+    // estimates and the splats it received, over its number of samples (one light subpath is traced
+    // per camera sample). The environment starts no light subpaths; camera subpaths gather it as
+    // ray_color() does.
+    void render_bidirectional(const entity& world, BS::thread_pool& pool,
+                              std::vector<std::vector<std::array<char, 32>>>& buffer) const {
+        vector<const entity*> leaves;
+        light_set->flatten(leaves);
+        light_tree emitters(leaves);
+        // the media every light sits in, found once here instead of by a probe through the whole
+        // scene per light subpath; a light is taken to be in the same media all over its surface
+        vector<medium_stack> light_media;
+        for (size_t i = 0; i < emitters.size(); i++) {
+            light_media.push_back(media_around(world, emitters.light(i)));
+        }
+        splat_buffer splats(IMAGE_WIDTH, IMAGE_HEIGHT);
+        std::vector<color> own(size_t(IMAGE_WIDTH) * IMAGE_HEIGHT, color(0,0,0));
+
+        const int block_size = 8;
+        auto block_count = ((IMAGE_WIDTH + block_size - 1) / block_size) * ((IMAGE_HEIGHT + block_size - 1) / block_size);
+        std::atomic<int> completed(0);
+        std::vector<std::future<void>> futures;
+        for (int j = 0; j < IMAGE_HEIGHT; j += block_size) {
+            for (int i = 0; i < IMAGE_WIDTH; i += block_size) {
+                futures.push_back(pool.submit_task([&, i, j]() {
+                    std::vector<path_vertex> camera_path(MAX_RECURSION_DEPTH + 1);
+                    std::vector<path_vertex> light_path(std::max(MAX_RECURSION_DEPTH, 1));
+                    for (int row = j; row < j + block_size && row < IMAGE_HEIGHT; row++) {
+                        for (int col = i; col < i + block_size && col < IMAGE_WIDTH; col++) {
+                            color pixel_color(0,0,0);
+                            for (int s_i = 0; s_i < sqrt_samples_per_pixel; s_i++) {
+                                for (int s_j = 0; s_j < sqrt_samples_per_pixel; s_j++) {
+                                    pixel_color += bidirectional_sample(get_ray(col, row, s_i, s_j), world, emitters,
+                                                                        light_media, splats, camera_path.data(),
+                                                                        light_path.data());
+                                }
+                            }
+                            own[size_t(row) * IMAGE_WIDTH + col] = pixel_color;
+                        }
+                    }
+                    completed.fetch_add(1);
+                    std::clog << "\rBlocks completed: " << completed.load() << "/" << block_count << std::flush;
+                }));
+            }
+        }
+        for (auto& future : futures) {
+            future.wait();
+        }
+
+        for (int j = 0; j < IMAGE_HEIGHT; j++) {
+            for (int i = 0; i < IMAGE_WIDTH; i++) {
+                std::ostringstream oss;
+                write_color(oss, (own[size_t(j) * IMAGE_WIDTH + i] + splats.value(i, j)) * sample_scale);
+                std::string pixel_str = oss.str();
+                std::copy(pixel_str.begin(), pixel_str.end(), buffer[j][i].begin());
+            }
+        }
+    }
+
+    // One sample of render_bidirectional() for camera ray r: what the pixel receives, with the
+    // light subpath's joins to the camera splatted. The paths are scratch space for the subpaths.
+    color bidirectional_sample(const ray& r, const entity& world, const light_tree& emitters,
+                               const vector<medium_stack>& light_media, splat_buffer& splats,
+                               path_vertex* camera_path, path_vertex* light_path) const {
+        color total(0,0,0); // starts with the background and environment, which no join reaches
+        auto& z0 = camera_path[0];
+        z0 = path_vertex();
+        z0.type = path_vertex::kind::camera;
+        z0.rec.p = r.origin();
+        z0.rec.normal = -w;
+        z0.media = camera_media;
+        z0.beta = color(1,1,1);
+        z0.pdf_forward = 1;
+        auto t_count = random_walk(world, r, z0.beta, camera_direction_pdf(r.direction()), camera_media,
+                                   camera_path, 1, MAX_RECURSION_DEPTH + 1, &total);
+        auto s_count = light_subpath(world, emitters, light_media, light_path);
+
+        for (int t = 1; t <= t_count; t++) {
+            for (int s = 0; s <= s_count; s++) {
+                // a path of s + t vertices has s + t - 1 segments; a light point seen straight from
+                // the camera is left to the camera subpath
+                if (s + t < 2 || s + t - 1 > MAX_RECURSION_DEPTH || (s == 1 && t == 1)) {
+                    continue;
+                }
+                total += connect(world, emitters, light_path, s, camera_path, t, splats);
+            }
+        }
+        return total;
+    }
+
+    // Starts a subpath on a light chosen by power, at a uniform point on its surface, leaving in a
+    // cosine-weighted direction (from either face, at random, of a two-sided light), and extends
+    // it. light_media holds the media around each light of emitters. Returns the number of
+    // vertices, 0 if no light could be sampled.
+    int light_subpath(const entity& world, const light_tree& emitters, const vector<medium_stack>& light_media,
+                      path_vertex* path) const {
+        auto& y0 = path[0];
+        y0 = path_vertex();
+        double choice;
+        size_t index;
+        auto light = emitters.sample_by_power(random_double(), choice, y0.two_sided, index);
+        if (MAX_RECURSION_DEPTH < 1 || !light || !light->sample_surface(y0.rec) || !y0.rec.materials) {
+            return 0;
+        }
+        auto emitted = y0.rec.materials->emit(y0.rec.u, y0.rec.v, y0.rec.p);
+        if (emitted.length_squared() == 0) {
+            return 0;
+        }
+        y0.type = path_vertex::kind::light;
+        y0.beta = emitted;
+        y0.pdf_forward = choice / light->surface_area();
+
+        auto face = y0.rec.normal;
+        if (y0.two_sided && random_double() < 0.5) {
+            face = -face;
+        }
+        auto direction = random_cosine_direction(face);
+        auto cosine = dot(face, unit_vector(direction));
+        auto pdf = cosine_hemisphere_pdf(cosine) * (y0.two_sided ? 0.5 : 1.0);
+        if (pdf <= 0) {
+            return 1;
+        }
+        auto from = offset_ray_origin(y0.rec.p, face, direction);
+        y0.media = light_media[index];
+        auto beta = emitted * (cosine / (y0.pdf_forward * pdf));
+        return random_walk(world, ray(from, direction), beta, pdf, y0.media, path, 1, MAX_RECURSION_DEPTH, nullptr);
+    }
+
+    // Extends the subpath path[0, count) along r, which carries throughput beta and whose direction
+    // the last vertex chose with solid angle density pdf, scattering at surfaces and in media as
+    // ray_color() does, until max_vertices are stored or the path ends. Returns the number stored.
+    // Camera subpaths pass `gathered`, which receives the background and environment light they
+    // meet: as in ray_color(), each vertex that can samples the environment, weighted against
+    // having found it by escaping.
+    int random_walk(const entity& world, ray r, color beta, double pdf, medium_stack media,
+                    path_vertex* path, int count, int max_vertices, color* gathered) const {
+        while (count < max_vertices) {
+            auto& previous = path[count - 1];
+            auto& v = path[count];
+            v = path_vertex();
+
+            entity_record record;
+            bool hit = world.hit(r, interval(0.001, inf), record);
+            real collision;
+            bool collided = false;
+            if (auto inside = media.current()) {
+                collided = inside->sample_collision(r, hit ? record.t : exit_distance(r), collision);
+                if (collided) {
+                    v.type = path_vertex::kind::medium;
+                    v.rec.p = r.at(collision);
+                    v.rec.normal = vec3(1,0,0);
+                    v.rec.front_face = true;
+                    v.rec.u = v.rec.v = 0;
+                    v.rec.materials = inside->phase_function();
+                }
+            }
+            if (!collided) {
+                if (!hit) {
+                    if (gathered) {
+                        auto environment_pdf = previous.type == path_vertex::kind::camera || previous.delta ? -1 : pdf;
+                        *gathered += beta * background(r, environment_pdf);
+                    }
+                    return count;
+                }
+                resolve_surface(r, record);
+                if (record.pass_through) {
+                    // an invisible medium boundary: carry on in the same direction, in the new medium
+                    media.cross(record.interior, record.front_face);
+                    auto width = r.cone_width() + r.cone_spread() * record.t * r.direction().length();
+                    auto spread = r.cone_spread();
+                    r = ray(offset_ray_origin(record.p, record.normal, r.direction()), r.direction(), r.time());
+                    r.set_cone(width, spread);
+                    continue;
+                }
+                v.rec = record;
+            }
+            v.arriving = r;
+            v.media = media;
+            v.beta = beta;
+            v.pdf_forward = area_density(pdf, previous, v);
+            if (++count == max_vertices) {
+                break;
+            }
+
+            real width;
+            if (collided) {
+                width = r.cone_width() + r.cone_spread() * collision * r.direction().length();
+            } else {
+                width = set_footprint(r, v.rec);
+            }
+            ray scattered;
+            color change;
+            if (!v.rec.materials->scatter(r, v.rec, change, scattered)) {
+                // e.g. an emitter, which the camera subpath may still have found by itself
+                v.delta = true;
+                break;
+            }
+            pdf = v.rec.materials->scattering_pdf(r, v.rec, scattered);
+            double reverse = 0;
+            if (pdf > 0) {
+                reverse = scattering_density(v, -scattered.direction(), -r.direction());
+                if (gathered && ENVIRONMENT) {
+                    *gathered += beta * environment_sample(r, v.rec, !collided, media, world);
+                }
+            } else {
+                pdf = 0;
+                v.delta = true;
+            }
+            previous.pdf_reverse = area_density(reverse, v, previous);
+            beta = beta * change;
+            if (beta.length_squared() == 0) {
+                break;
+            }
+            if (collided) {
+                r = scattered;
+                r.set_cone(width, v.arriving.cone_spread());
+            } else {
+                r = bounce(r, v.rec, scattered, width);
+                if (v.rec.interior && dot(r.direction(), v.rec.normal) < 0) {
+                    media.cross(v.rec.interior, v.rec.front_face);
+                }
+            }
+        }
+        return count;
+    }
+
+    // The strategy that joins the first s vertices of the light subpath to the first t of the
+    // camera subpath, weighted. Joins to the camera (t == 1) are splatted and return zero.
+    color connect(const entity& world, const light_tree& emitters, const path_vertex* light_path, int s,
+                  const path_vertex* camera_path, int t, splat_buffer& splats) const {
+        path_vertex sampled; // the end vertex the join samples itself, for s == 1 and t == 1
+        color contribution(0,0,0);
+        if (s == 0) {
+            // the camera subpath met an emitter by itself
+            const auto& pt = camera_path[t - 1];
+            if (pt.type != path_vertex::kind::surface) {
+                return color(0,0,0);
+            }
+            contribution = pt.beta * pt.rec.materials->emit(pt.rec.u, pt.rec.v, pt.rec.p);
+        } else if (t == 1) {
+            // light subpath to a point on the lens, splatted on the pixel it is seen through
+            const auto& qs = light_path[s - 1];
+            if (qs.delta) {
+                return color(0,0,0);
+            }
+            sampled.type = path_vertex::kind::camera;
+            sampled.rec.p = DEFOCUS_ANGLE <= 0 ? camera_center : sample_from_defocus_disk();
+            sampled.rec.normal = -w;
+            int col, row;
+            if (!raster_position(sampled.rec.p, qs.rec.p, col, row)) {
+                return color(0,0,0);
+            }
+            auto to_camera = sampled.rec.p - qs.rec.p;
+            auto cosine = dot(unit_vector(-to_camera), -w);
+            // importance the camera gives this direction per unit of qs's area: the camera's
+            // direction density, which is over the image, over the cosine and squared distance
+            auto importance = 1 / (film_area() * cosine * cosine * cosine * to_camera.length_squared());
+            contribution = qs.beta * scattering_value(qs, qs.arriving.direction(), to_camera) * importance;
+            if (contribution.length_squared() == 0) {
+                return color(0,0,0);
+            }
+            contribution *= transmittance_between(qs, sampled.rec.p, world);
+            if (contribution.length_squared() > 0) {
+                splats.add(col, row, contribution * mis_weight(emitters, light_path, s, camera_path, t, sampled));
+            }
+            return color(0,0,0);
+        } else if (s == 1) {
+            // camera subpath to a light point sampled from it
+            const auto& pt = camera_path[t - 1];
+            if (pt.delta) {
+                return color(0,0,0);
+            }
+            auto direction = light_set->random(pt.rec.p);
+            if (direction.length_squared() == 0) {
+                return color(0,0,0);
+            }
+            ray towards(pt.rec.p, direction);
+            if (!light_set->hit(towards, interval(0.001, inf), sampled.rec)) {
+                return color(0,0,0);
+            }
+            resolve_surface(towards, sampled.rec);
+            auto pdf = light_set->pdf_value(pt.rec.p, direction);
+            if (pdf <= 0 || !sampled.rec.materials) {
+                return color(0,0,0);
+            }
+            sampled.type = path_vertex::kind::light;
+            // the density of the sample actually taken, per unit of light area; the tree is only
+            // asked which faces the light emits from
+            sampled.pdf_forward = light_area_pdf(pt.rec.p, light_point{sampled.rec.p, sampled.rec.normal, color(0,0,0)});
+            emitters.origin_pdf(pt.rec.p, sampled.rec.p, sampled.two_sided);
+            auto emitted = sampled.rec.materials->emit(sampled.rec.u, sampled.rec.v, sampled.rec.p);
+            contribution = pt.beta * scattering_value(pt, pt.arriving.direction(), direction) * emitted / pdf;
+            if (contribution.length_squared() == 0) {
+                return color(0,0,0);
+            }
+            contribution *= transmittance_between(pt, sampled.rec.p, world);
+        } else {
+            const auto& qs = light_path[s - 1];
+            const auto& pt = camera_path[t - 1];
+            if (qs.delta || pt.delta) {
+                return color(0,0,0);
+            }
+            auto to_light = qs.rec.p - pt.rec.p;
+            auto distance_squared = to_light.length_squared();
+            if (distance_squared <= 0) {
+                return color(0,0,0);
+            }
+            contribution = pt.beta * scattering_value(pt, pt.arriving.direction(), to_light)
+                           * scattering_value(qs, qs.arriving.direction(), -to_light) * qs.beta / distance_squared;
+            if (contribution.length_squared() == 0) {
+                return color(0,0,0);
+            }
+            contribution *= transmittance_between(pt, qs.rec.p, world);
+        }
+        if (contribution.length_squared() == 0) {
+            return color(0,0,0);
+        }
+        return contribution * mis_weight(emitters, light_path, s, camera_path, t, sampled);
+    }
+
+    // Balance heuristic weight of the join of s light and t camera vertices against every other
+    // split of the same path into a light and a camera subpath (Veach, section 10.2). Only ratios
+    // of each vertex's density under the two directions of sampling are needed: they are taken
+    // outward from the join, with the densities of the four vertices next to it worked out for
+    // this join. sampled is the end vertex the join sampled itself, for s == 1 and t == 1.
+    //
+    // The light point is placed differently depending on the split: by power from the light tree
+    // when the light subpath has two or more vertices, by the light set from the next vertex when
+    // it has one, and by meeting it when it has none. Its density is therefore left out of the
+    // ratios and each split's own is multiplied in; a split whose density is zero, such as an
+    // emitter neither the tree nor the light set can sample, gets no share.
+    double mis_weight(const light_tree& emitters, const path_vertex* light_path, int s,
+                      const path_vertex* camera_path, int t, const path_vertex& sampled) const {
+        if (s + t == 2) {
+            return 1;
+        }
+        const path_vertex* qs = s == 1 ? &sampled : (s > 1 ? &light_path[s - 1] : nullptr);
+        const path_vertex* pt = t == 1 ? &sampled : &camera_path[t - 1];
+        const path_vertex* qs_minus = s > 1 ? &light_path[s - 2] : nullptr;
+        const path_vertex* pt_minus = t > 1 ? &camera_path[t - 2] : nullptr;
+
+        double pt_reverse;
+        double by_power = 0; // density of the light point when the tree picks it by power
+        path_vertex emitter;
+        if (s > 0) {
+            pt_reverse = vertex_pdf(qs_minus, *qs, *pt);
+        } else {
+            // the emitter the camera subpath met, as the start of a light subpath, emitting from
+            // the faces the tree would have it emit from
+            emitter = *pt;
+            emitter.type = path_vertex::kind::light;
+            emitter.delta = false;
+            emitter.two_sided = false;
+            by_power = emitters.origin_pdf(pt_minus->rec.p, emitter.rec.p, emitter.two_sided);
+            pt_reverse = 1; // the light point's density, see below
+            pt = &emitter;
+        }
+        auto pt_minus_reverse = pt_minus ? vertex_pdf(qs, *pt, *pt_minus) : 0.0;
+        auto qs_reverse = qs ? vertex_pdf(pt_minus, *pt, *qs) : 0.0;
+        auto qs_minus_reverse = qs_minus ? vertex_pdf(pt, *qs, *qs_minus) : 0.0;
+
+        // the light point and the vertex it is joined to or continues to
+        const auto& light = s == 0 ? emitter : (s == 1 ? sampled : light_path[0]);
+        const auto& next = s == 0 ? pt_minus->rec.p : (s == 1 ? pt->rec.p : light_path[1].rec.p);
+        if (s > 0) {
+            bool two_sided;
+            by_power = s >= 2 ? light.pdf_forward : emitters.origin_pdf(next, light.rec.p, two_sided);
+        }
+        auto by_light_set = s == 1 ? light.pdf_forward
+                                   : light_area_pdf(next, light_point{light.rec.p, light.rec.normal, color(0,0,0)});
+        auto light_density = [&](int light_vertices) {
+            return light_vertices == 0 ? 1.0 : (light_vertices == 1 ? by_light_set : by_power);
+        };
+
+        // Past a specular vertex neither direction has a density; that ratio is 1. A density that
+        // is zero otherwise means the split cannot produce the path, so it stays zero; a vertex a
+        // subpath did reach has a density, zero only where it was reached specularly.
+        auto reverse_density = [](double pdf, bool after_specular) { return pdf == 0 && after_specular ? 1.0 : pdf; };
+        auto forward_density = [](double pdf) { return pdf != 0 ? pdf : 1.0; };
+        double sum = 0;
+        double ratio = 1;
+        for (int i = t - 1; i > 0; i--) {
+            // out of the scene's bounds only a camera ray can scatter off the global medium: a
+            // light subpath that leaves them stops sampling it and never meets a surface again
+            if (camera_path[i].type == path_vertex::kind::medium && !inside_scene(camera_path[i].rec.p)) {
+                break;
+            }
+            auto reverse = i == t - 1 ? pt_reverse : (i == t - 2 ? pt_minus_reverse : camera_path[i].pdf_reverse);
+            auto after_specular = i == t - 1 ? qs && qs->delta : (i == t - 2 ? pt->delta : camera_path[i + 1].delta);
+            ratio *= reverse_density(reverse, after_specular) / forward_density(camera_path[i].pdf_forward);
+            // a split next to a specular vertex would have to join through it
+            if (!(i < t - 1 && camera_path[i].delta) && !camera_path[i - 1].delta) {
+                sum += ratio * light_density(s + t - i);
+            }
+        }
+        ratio = 1;
+        for (int i = s - 1; i >= 0; i--) {
+            const auto& v = i == s - 1 ? *qs : light_path[i];
+            auto reverse = i == s - 1 ? qs_reverse : (i == s - 2 ? qs_minus_reverse : light_path[i].pdf_reverse);
+            auto after_specular = i == s - 1 ? pt->delta : (i == s - 2 ? qs->delta : light_path[i + 1].delta);
+            ratio *= reverse_density(reverse, after_specular) / (i == 0 ? 1.0 : forward_density(v.pdf_forward));
+            if (!(i < s - 1 && light_path[i].delta) && !(i > 0 && light_path[i - 1].delta)) {
+                sum += ratio * light_density(i);
+            }
+        }
+        auto own = light_density(s);
+        return own > 0 ? own / (own + sum) : 0;
+    }
+
+    // Density, per unit area at next, with which a subpath that reached cur from previous (nullptr
+    // where cur starts the subpath) continues to next.
+    double vertex_pdf(const path_vertex* previous, const path_vertex& cur, const path_vertex& next) const {
+        auto to_next = next.rec.p - cur.rec.p;
+        double pdf;
+        if (cur.type == path_vertex::kind::camera) {
+            pdf = camera_direction_pdf(to_next);
+        } else if (cur.type == path_vertex::kind::light) {
+            auto outward = cur.rec.front_face ? cur.rec.normal : -cur.rec.normal;
+            auto cosine = dot(outward, unit_vector(to_next));
+            pdf = cur.two_sided ? 0.5 * cosine_hemisphere_pdf(fabs(cosine)) : cosine_hemisphere_pdf(cosine);
+        } else {
+            pdf = scattering_density(cur, cur.rec.p - previous->rec.p, to_next);
+        }
+        return area_density(pdf, cur, next);
+    }
+
+    // Solid angle density pdf at `from` of the direction to `to`, as a density per unit area at
+    // `to`; media have no surface to project onto.
+    static double area_density(double pdf, const path_vertex& from, const path_vertex& to) {
+        auto between = to.rec.p - from.rec.p;
+        auto distance_squared = between.length_squared();
+        if (distance_squared <= 0) {
+            return 0;
+        }
+        if (to.type != path_vertex::kind::medium && to.type != path_vertex::kind::camera) {
+            pdf *= fabs(dot(to.rec.normal, between)) / sqrt(distance_squared);
+        }
+        return pdf / distance_squared;
+    }
+
+    // v's record turned to face light arriving along `in`, as either end of a path may be the one
+    // evaluating it.
+    static entity_record facing(const path_vertex& v, const vec3& in) {
+        auto rec = v.rec;
+        if (v.type == path_vertex::kind::surface) {
+            rec.set_face_normal(ray(rec.p, in), rec.front_face ? rec.normal : -rec.normal);
+        }
+        return rec;
+    }
+
+    // Density with which v's material scatters travel along `in` into `out`.
+    static double scattering_density(const path_vertex& v, const vec3& in, const vec3& out) {
+        auto rec = facing(v, in);
+        return rec.materials->scattering_pdf(ray(rec.p - in, in), rec, ray(rec.p, out));
+    }
+
+    // v's BSDF times the cosine on the side of `out`, for travel along `in` scattered into `out`.
+    static color scattering_value(const path_vertex& v, const vec3& in, const vec3& out) {
+        auto rec = facing(v, in);
+        return rec.materials->scattering_bsdf(ray(rec.p - in, in), rec, ray(rec.p, out));
+    }
+
+    // Fraction of light that travels between vertex v and point p: shadow_transmittance() from v,
+    // off v's surface on the side facing p.
+    double transmittance_between(const path_vertex& v, const point3& p, const entity& world) const {
+        auto direction = unit_vector(p - v.rec.p);
+        auto from = v.rec.p;
+        auto media = v.media;
+        if (v.type == path_vertex::kind::surface) {
+            from = offset_ray_origin(v.rec.p, v.rec.normal, direction);
+            if (v.rec.interior && dot(direction, v.rec.normal) < 0) {
+                media.cross(v.rec.interior, v.rec.front_face);
+            }
+        }
+        return shadow_transmittance(from, direction, (p - from).length(), media, world);
+    }
+
+    // Area of the image on the plane at unit distance in front of the camera.
+    [[nodiscard]] double film_area() const {
+        return pixel_delta_u.length() * IMAGE_WIDTH * pixel_delta_v.length() * IMAGE_HEIGHT
+               / (FOCUS_DISTANCE * FOCUS_DISTANCE);
+    }
+
+    // Solid angle density of camera ray directions, which get_ray() spreads uniformly over the
+    // image on the focus plane.
+    [[nodiscard]] double camera_direction_pdf(const vec3& direction) const {
+        auto cosine = dot(unit_vector(direction), -w);
+        if (cosine <= 0) {
+            return 0;
+        }
+        return 1 / (film_area() * cosine * cosine * cosine);
+    }
+
+    // Pixel through which the line from lens point `lens` to p crosses the focus plane; false if
+    // it misses the image.
+    bool raster_position(const point3& lens, const point3& p, int& col, int& row) const {
+        auto d = p - lens;
+        auto along = dot(d, -w);
+        if (along <= 0) {
+            return false;
+        }
+        auto on_plane = lens + d * (FOCUS_DISTANCE / along) - pixel_0_loc;
+        auto x = dot(on_plane, pixel_delta_u) / pixel_delta_u.length_squared() + 0.5;
+        auto y = dot(on_plane, pixel_delta_v) / pixel_delta_v.length_squared() + 0.5;
+        if (!(x >= 0 && y >= 0 && x < IMAGE_WIDTH && y < IMAGE_HEIGHT)) {
+            return false;
+        }
+        col = int(x);
+        row = int(y);
+        return true;
+    }
+
+    // media holds the media incoming starts in; it is a copy, as each path changes its own.
+    // scatter_pdf is the solid angle density with which the vertex incoming leaves chose its
+    // direction when that vertex also sampled the lights, or -1 when it did not (camera rays and
+    // specular bounces). Light that incoming then finds by chance could have been found by the
+    // light sample too, and is weighted against it by the balance heuristic. With lights_gathered
+    // the vertex has already gathered everything the lights send it (medium_direct_light() along a
+    // medium segment, or a pixel's reservoir), so emitters found by chance are skipped outright.
+    color ray_color(const ray& incoming, const entity& world, int curr_depth, medium_stack media,
+                    double scatter_pdf = -1, bool lights_gathered = false) const {
 //        clog << "Entered ray color \n";
         if (curr_depth <= 0) {
 //            clog << "Exit ray color through max depth \n";
             return color(0,0,0);
         }
+        ray r = incoming;
         entity_record record;
-        if (world.hit(r, interval(0.001, inf), record)) {
-            ray scattered;
-            color change;
-            color emitted_color = record.materials->emit(record.u, record.v, record.p);
-            if (!record.materials->scatter(r, record, change, scattered)) {
+        bool hit;
+        color in_scattered(0,0,0); // light scattered towards us along the segments walked so far
+        while (true) {
+            hit = world.hit(r, interval(0.001, inf), record);
+
+            // the medium the segment runs through may scatter the light before the surface
+            real collision;
+            auto inside = media.current();
+            bool collided = false;
+            if (inside) {
+                auto t_end = hit ? record.t : exit_distance(r);
+                collided = inside->sample_collision(r, t_end, collision);
+                // a light connection is one more bounce, so the last vertex of a path makes none
+                if (light_set && curr_depth > 1) {
+                    in_scattered += medium_direct_light(r, t_end, *inside, media, world, collided, collision);
+                }
+            }
+            if (collided) {
+                entity_record event;
+                event.p = r.at(collision);
+                event.normal = vec3(1,0,0);
+                event.front_face = true;
+                event.u = event.v = 0;
+                event.materials = inside->phase_function();
+
+                ray scattered;
+                color change;
+                if (!event.materials->scatter(r, event, change, scattered)) {
+                    return in_scattered;
+                }
+                scattered.set_cone(r.cone_width() + r.cone_spread() * collision * r.direction().length(),
+                                   r.cone_spread());
+                double phase_pdf = -1;
+                if (curr_depth > 1) {
+                    in_scattered += direct_light(r, event, false, media, world);
+                    phase_pdf = event.materials->scattering_pdf(r, event, scattered);
+                }
+                return in_scattered + change * ray_color(scattered, world, curr_depth-1, media, phase_pdf, true);
+            }
+            if (!hit) {
+                return in_scattered + background(r, scatter_pdf);
+            }
+            resolve_surface(r, record);
+            if (!record.pass_through) {
+                break;
+            }
+            // an invisible medium boundary: carry on in the same direction, in the new medium
+            media.cross(record.interior, record.front_face);
+            auto width = r.cone_width() + r.cone_spread() * record.t * r.direction().length();
+            auto spread = r.cone_spread();
+            r = ray(offset_ray_origin(record.p, record.normal, r.direction()), r.direction(), r.time());
+            r.set_cone(width, spread);
+        }
+        auto width = set_footprint(r, record);
+
+        ray scattered;
+        color change;
+        color emitted_color = record.materials->emit(record.u, record.v, record.p);
+        if (scatter_pdf >= 0 && light_set && emitted_color.length_squared() > 0) {
+            auto light_pdf = light_set->pdf_value(incoming.origin(), incoming.direction());
+            if (light_pdf > 0) {
+                emitted_color *= lights_gathered ? 0 : scatter_pdf / (scatter_pdf + light_pdf);
+            }
+        }
+        emitted_color += in_scattered;
+        if (!record.materials->scatter(r, record, change, scattered)) {
 //                clog << "Exited ray color with no scatter \n";
-                return emitted_color;
+            return emitted_color;
+        }
+        // materials with a density for their directions can be lit by light samples; specular
+        // ones (density zero) cannot
+        double material_pdf = -1;
+        if ((light_set || ENVIRONMENT) && curr_depth > 1) {
+            material_pdf = record.materials->scattering_pdf(r, record, scattered);
+            if (material_pdf > 0) {
+                emitted_color += direct_light(r, record, true, media, world);
+            } else {
+                material_pdf = -1;
             }
+        }
+        scattered = bounce(r, record, scattered, width);
+        // light passing through a surface that bounds a medium enters or leaves it
+        if (record.interior && dot(scattered.direction(), record.normal) < 0) {
+            media.cross(record.interior, record.front_face);
+        }
 //            clog << "Exited ray color through recursio\n";
-            color scattered_color = change * ray_color(scattered, world, curr_depth-1);
-            return scattered_color + emitted_color;
+        color scattered_color = change * ray_color(scattered, world, curr_depth-1, media, material_pdf);
+        return scattered_color + emitted_color;
+    }
+
+    // Sets record.footprint, the width of r's cone at the hit stretched by the angle it meets the
+    // surface at, and returns the unstretched width.
+    static real set_footprint(const ray& r, entity_record& record) {
+        auto length = r.direction().length();
+        auto width = r.cone_width() + r.cone_spread() * record.t * length;
+        auto cosine = fabs(dot(record.normal, r.direction())) / length;
+        record.footprint = width / fmax(cosine, real(0.05));
+        return width;
+    }
+
+    // scattered as a ray leaving the surface of record, where r's cone is width wide
+    static ray bounce(const ray& r, const entity_record& record, const ray& scattered, real width) {
+        // start the bounce just off the surface so rounding in p cannot hit it again
+        ray leaving(offset_ray_origin(record.p, record.normal, scattered.direction()),
+                    scattered.direction(), scattered.time());
+        // the bounce keeps the cone as if the surface were a flat mirror; curvature and
+        // roughness would only widen it, so textures seen after a bounce err towards sharp
+        leaving.set_cone(width, r.cone_spread());
+        return leaving;
+    }
+
+    // What a ray leaving the scene sees: BACKGROUND, or the environment weighted against having
+    // sampled it directly from the vertex the ray left (see ray_color()).
+    color background(const ray& r, double scatter_pdf) const {
+        if (!ENVIRONMENT) {
+            return BACKGROUND;
+        }
+        auto radiance = ENVIRONMENT->value(r.direction(), r.cone_spread());
+        if (scatter_pdf >= 0) {
+            auto environment_pdf = ENVIRONMENT->pdf_value(r.origin(), r.direction());
+            if (environment_pdf > 0) {
+                radiance *= scatter_pdf / (scatter_pdf + environment_pdf);
+            }
+        }
+        return radiance;
+    }
+
+    // Light reaching vertex rec from one sample of the lights and one of the environment, each
+    // weighted by the balance heuristic against rec's material having chosen the same direction:
+    // bsdf * Le * visibility / (pdf_light + pdf_material), in solid angle. r_in arrives at rec,
+    // which is on a surface or, without on_surface, a scattering event inside a medium; there the
+    // lights are connected along the whole segment by medium_direct_light() instead, so only the
+    // environment is sampled.
+    color direct_light(const ray& r_in, const entity_record& rec, bool on_surface, const medium_stack& media,
+                       const entity& world) const {
+        color total(0,0,0);
+        if (light_set && on_surface) {
+            total += light_set_sample(r_in, rec, media, world);
+        }
+        if (ENVIRONMENT) {
+            total += environment_sample(r_in, rec, on_surface, media, world);
+        }
+        return total;
+    }
+
+    color light_set_sample(const ray& r_in, const entity_record& rec, const medium_stack& media,
+                           const entity& world) const {
+        light_point light;
+        if (!sample_light(rec.p, light)) {
+            return color(0,0,0);
+        }
+        auto to = light.p - rec.p;
+        auto pdf = light_set->pdf_value(rec.p, to);
+        if (pdf <= 0 || light.emitted.length_squared() == 0) {
+            return color(0,0,0);
+        }
+        return connect_direction(r_in, rec, true, unit_vector(to), to.length(), pdf, light.emitted, media, world);
+    }
+
+    color environment_sample(const ray& r_in, const entity_record& rec, bool on_surface, const medium_stack& media,
+                             const entity& world) const {
+        auto direction = unit_vector(ENVIRONMENT->random(rec.p));
+        auto pdf = ENVIRONMENT->pdf_value(rec.p, direction);
+        if (pdf <= 0) {
+            return color(0,0,0);
+        }
+        return connect_direction(r_in, rec, on_surface, direction, inf, pdf, ENVIRONMENT->value(direction), media,
+                                 world);
+    }
+
+    // One term of direct_light(): radiance arriving at rec from `distance` away along the unit
+    // vector direction, which a light strategy sampled with solid angle density pdf.
+    color connect_direction(const ray& r_in, const entity_record& rec, bool on_surface, const vec3& direction,
+                            double distance, double pdf, const color& radiance, medium_stack media,
+                            const entity& world) const {
+        ray towards(rec.p, direction);
+        auto bsdf = rec.materials->scattering_bsdf(r_in, rec, towards);
+        if (bsdf.length_squared() == 0) {
+            return color(0,0,0);
+        }
+        auto material_pdf = rec.materials->scattering_pdf(r_in, rec, towards);
+        auto from = rec.p;
+        if (on_surface) {
+            from = offset_ray_origin(rec.p, rec.normal, direction);
+            distance = (distance < inf) ? (rec.p + distance * direction - from).length() : inf;
+            if (rec.interior && dot(direction, rec.normal) < 0) {
+                media.cross(rec.interior, rec.front_face);
+            }
+        }
+        auto visible = shadow_transmittance(from, direction, distance, media, world);
+        if (visible <= 0) {
+            return color(0,0,0);
+        }
+        return bsdf * radiance * (visible / (pdf + material_pdf));
+    }
+
+    // Single scattering from the lights along the segment of r up to t_end inside medium m (Kulla
+    // and Fajardo, "Importance Sampling Techniques for Path Tracing in Participating Media").
+    // Two points on the segment connect to the lights: one placed by equiangular sampling towards
+    // a light point chosen first, which concentrates near lights, and the free-flight collision
+    // the path continues from, if there is one. Both are weighted by the balance heuristic over
+    // the two ways of placing a point, so each contributes f / (pdf_equiangular + pdf_distance)
+    // with the light point's area density folded into each.
+    color medium_direct_light(const ray& r, real t_end, const medium& m, const medium_stack& media,
+                              const entity& world, bool collided, real collision) const {
+        auto length = r.direction().length();
+        auto s_end = t_end * length;
+        auto origin = r.origin();
+        auto direction = r.direction() / length;
+        color total(0,0,0);
+
+        light_point light;
+        if (sample_light(origin, light)) {
+            // Equiangular: uniform in the angle the segment subtends at the light point
+            auto delta = dot(light.p - origin, direction);
+            auto distance = fmax((light.p - (origin + delta * direction)).length(), 1e-6);
+            auto theta_a = atan2(-delta, distance);
+            auto theta_b = atan2(s_end - delta, distance);
+            if (theta_b > theta_a) {
+                auto s = delta + distance * tan(theta_a + random_double() * (theta_b - theta_a));
+                s = fmin(fmax(s, 0.0), s_end);
+                total += connect_light(r, s / length, s_end, light, m, media, world);
+            }
+        }
+        if (collided && sample_light(r.at(collision), light)) {
+            total += connect_light(r, collision, s_end, light, m, media, world);
+        }
+        return total;
+    }
+
+    bool sample_light(const point3& from, light_point& light) const {
+        auto direction = light_set->random(from);
+        if (direction.length_squared() == 0) {
+            return false; // no light can reach from
+        }
+        entity_record rec;
+        ray towards(from, direction);
+        if (!light_set->hit(towards, interval(0.001, inf), rec)) {
+            return false;
+        }
+        resolve_surface(towards, rec);
+        light.p = rec.p;
+        light.normal = rec.normal;
+        light.emitted = rec.materials ? rec.materials->emit(rec.u, rec.v, rec.p) : color(0,0,0);
+        return true;
+    }
+
+    // Density over the lights' area with which sample_light(from) produces point p.
+    double light_area_pdf(const point3& from, const light_point& light) const {
+        auto to = light.p - from;
+        auto distance_squared = to.length_squared();
+        if (distance_squared <= 0) {
+            return 0;
+        }
+        auto cosine = fabs(dot(light.normal, to)) / sqrt(distance_squared);
+        return light_set->pdf_value(from, to) * cosine / distance_squared;
+    }
+
+    // Density, per unit distance along the segment [0, s_end], of equiangular sampling about a
+    // point at distance `closest` from the line whose foot lies at distance delta along it.
+    static double equiangular_pdf(double s, double delta, double closest, double s_end) {
+        auto theta_a = atan2(-delta, closest);
+        auto theta_b = atan2(s_end - delta, closest);
+        if (!(theta_b > theta_a) || s < 0 || s > s_end) {
+            return 0;
+        }
+        auto offset = s - delta;
+        return closest / ((theta_b - theta_a) * (closest * closest + offset * offset));
+    }
+
+    // Contribution of light point `light` scattered at r.at(t) towards r's origin, divided by the
+    // summed densities of both strategies for placing that (t, light point) pair. s_end is the
+    // length of the segment.
+    color connect_light(const ray& r, real t, double s_end, const light_point& light, const medium& m,
+                        const medium_stack& media, const entity& world) const {
+        auto length = r.direction().length();
+        auto origin = r.origin();
+        auto direction = r.direction() / length;
+        auto s = t * length;
+        auto y = r.at(t);
+        auto to = light.p - y;
+        auto distance_squared = to.length_squared();
+        if (distance_squared <= 0 || light.emitted.length_squared() == 0) {
+            return color(0,0,0);
+        }
+        auto distance = sqrt(distance_squared);
+        auto cosine_light = fabs(dot(light.normal, to)) / distance;
+
+        entity_record event;
+        event.p = y;
+        event.normal = vec3(1,0,0);
+        event.front_face = true;
+        event.u = event.v = 0;
+        auto phase = m.phase_function();
+        auto bsdf = phase->scattering_bsdf(r, event, ray(y, to));
+
+        auto reaching = m.transmittance(r, t);
+        auto sigma = m.density(y);
+        auto f = reaching * sigma * bsdf * light.emitted * (cosine_light / distance_squared);
+        if (f.length_squared() == 0) {
+            return color(0,0,0);
+        }
+
+        // densities per unit distance along the ray, times the light point's area density
+        auto delta = dot(light.p - origin, direction);
+        auto closest = fmax((light.p - (origin + delta * direction)).length(), 1e-6);
+        auto equiangular = equiangular_pdf(s, delta, closest, s_end) * light_area_pdf(origin, light);
+        auto free_flight = sigma * reaching * light_area_pdf(y, light);
+        if (equiangular + free_flight <= 0) {
+            return color(0,0,0);
+        }
+        auto visible = shadow_transmittance(y, to / distance, distance, media, world);
+        return f * (visible / (equiangular + free_flight));
+    }
+
+    // Fraction of the light leaving the point `distance` away from `from` along the unit vector
+    // direction that arrives at `from`: zero behind any surface, otherwise the transmittance of
+    // the media in between. An infinite distance stands for the environment, which media reach no
+    // further than the scene's bounds. media are the ones `from` is in; invisible medium
+    // boundaries on the way are crossed like in ray_color().
+    double shadow_transmittance(const point3& from, const vec3& direction, double distance, medium_stack media,
+                                const entity& world) const {
+        auto to = from + (distance < inf ? distance : 0.0) * direction;
+        ray shadow(from, direction);
+        double fraction = 1;
+        for (int crossings = 0; crossings < 64; crossings++) {
+            // stop just short of the light's own surface
+            auto remaining = distance < inf ? (to - shadow.origin()).length() : inf;
+            entity_record rec;
+            bool blocked = world.hit(shadow, interval(0.001, remaining * (1 - 1e-4)), rec);
+            if (auto inside = media.current()) {
+                auto reach = distance < inf ? remaining : double(exit_distance(shadow));
+                fraction *= inside->transmittance(shadow, blocked ? rec.t : reach);
+            }
+            if (!blocked) {
+                return fraction;
+            }
+            resolve_surface(shadow, rec);
+            if (!rec.pass_through) {
+                return 0;
+            }
+            media.cross(rec.interior, rec.front_face);
+            shadow = ray(offset_ray_origin(rec.p, rec.normal, direction), direction);
+        }
+        return 0;
+    }
+
+    [[nodiscard]] bool inside_scene(const point3& p) const {
+        for (int a = 0; a < 3; a++) {
+            if (!scene_bounds.axis_of_interval(a).contains(p[a])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Ray parameter at which r leaves the scene's bounding box, the end of the global medium.
+    real exit_distance(const ray& r) const {
+        real t_exit = inf;
+        for (int a = 0; a < 3; a++) {
+            const auto& axis = scene_bounds.axis_of_interval(a);
+            auto d = r.direction()[a];
+            if (d != 0) {
+                t_exit = fmin(t_exit, ((d > 0 ? axis.max : axis.min) - r.origin()[a]) / d);
+            }
+        }
+        return fmax(t_exit, real(0));
+    }
+
+    // Media around emitter light, seen from just in front of a point on its surface.
+    medium_stack media_around(const entity& world, const entity& light) const {
+        entity_record rec;
+        if (light.sample_surface(rec)) {
+            return media_enclosing(world, offset_ray_origin(rec.p, rec.normal, rec.normal), GLOBAL_MEDIUM.get());
+        }
+        medium_stack media;
+        if (GLOBAL_MEDIUM) {
+            media.enter(GLOBAL_MEDIUM.get());
+        }
+        return media;
+    }
+
+    // Media a point (the camera, or a light) sits inside, on top of the global
+    // medium. A probe ray leaves the point and runs through every surface until it leaves the
+    // scene; any medium whose boundary it exits without having entered it encloses the point.
+    // Boundaries exited first are the innermost.
+    static medium_stack media_enclosing(const entity& world, const point3& center, const medium* global) {
+        vector<const medium*> entered, enclosing;
+        ray probe(center, vec3(0.2113, 0.5774, 0.7887));
+        for (int crossings = 0; crossings < 1024; crossings++) {
+            entity_record rec;
+            if (!world.hit(probe, interval(0.001, inf), rec)) {
+                break;
+            }
+            resolve_surface(probe, rec);
+            if (rec.interior) {
+                auto found = std::find(entered.begin(), entered.end(), rec.interior);
+                if (rec.front_face) {
+                    entered.push_back(rec.interior);
+                } else if (found != entered.end()) {
+                    entered.erase(found);
+                } else {
+                    enclosing.push_back(rec.interior);
+                }
+            }
+            probe = ray(offset_ray_origin(rec.p, rec.normal, probe.direction()), probe.direction());
+        }
+        medium_stack media;
+        if (global) {
+            media.enter(global);
+        }
+        for (auto m = enclosing.rbegin(); m != enclosing.rend(); ++m) {
+            media.enter(*m);
         }
-//        vec3 unit_dir = unit_vector(r.direction());
-//        auto a = 0.5*(unit_dir.y()+1.0);
-//        clog << "Exited ray color through no hit \n";
-//        return (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5,0.7,1.0);
-        return BACKGROUND;
+        return media;
     }
 
 
 
     static vec3 sample_for_antialiasing() {
-        return {random_double() - 0.5, random_double() - 0.5, 0};
+        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
     }
 
     // Function for generating origin camera ray from defocus disk and pointing towards random points in square around pixel
@@ -232,11 +1490,15 @@ private:
             origin = sample_from_defocus_disk();
         }
         auto dir = pixel_location-origin;
-        return ray(origin, dir);
+        ray r(origin, dir);
+        r.set_cone(0, pixel_spread);
+        return r;
     }
 
     point3 sample_from_defocus_disk() const {
-        auto random_p = random_in_disk();
+        auto r1 = random_double();
+        auto r2 = random_double();
+        auto random_p = sample_concentric_disk(r1, r2);
         return camera_center + (random_p[0] * disk_hr) + (random_p[1] * disk_vr);
     }
 
@@ -21,6 +21,11 @@ inline double linear_space_to_gamma_space(double linear) {
     return 0.0;
 }
 
+// Perceived brightness of a linear color (Rec. 709 weights).
+inline double luminance(const color& c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 void write_color(std::ostream &out, color pixel_color) {
     auto red_component = pixel_color.x();
     auto green_component = pixel_color.y();
@@ -0,0 +1,408 @@
+//
+// Created by Aryan Singh on 6/15/24.
+//
+
+#ifndef GRAPHICA_COMPILED_SCENE_H
+#define GRAPHICA_COMPILED_SCENE_H
+
+#include "constants.h"
+#include "entity.h"
+#include "material.h"
+#include "sphere.h"
+#include "quadrilateral.h"
+#include "cuboid.h"
+#include "pyramid.h"
+#include "triangular_prism.h"
+#include "triangle_soa.h"
+#include "light_tree.h"
+#include <algorithm>
+#include <cstdint>
+#include <typeinfo>
+#include <vector>
+
+// Render-time layout of a scene. Scenes are still authored as a graph of shared_ptr<entity>; before
+// rendering the graph is flattened and its primitives are copied, grouped by type, into contiguous
+// arrays (spheres, quads, boxes, and the triangles of pyramids / prisms in four-wide SoA blocks).
+// A single BVH is built over all of them whose leaves refer to primitives by (type, index), and
+// the traversal dispatches with a switch and non-virtual calls instead of through vtables.
+//
+// Entities without a compiled form (instances, volumes, sphere sets, ...) are kept as references
+// into the authoring graph, which therefore has to outlive the compiled scene.
+//
+// Emitting primitives are collected into a light_tree as the scene is compiled, so the integrator
+// can sample lights without being told which entities emit.
+class compiled_scene : public entity {
+public:
+    explicit compiled_scene(const entity& world) {
+        vector<const entity*> leaves;
+        world.flatten(leaves);
+
+        // hits point entity_record::primitive into these arrays, so they are not touched after construction
+        vector<build_item> items;
+        vector<triangle_source> sources;
+        for (auto leaf : leaves) {
+            // only exactly these types are compiled: a subclass (e.g. disk) would lose its
+            // overrides in the copy, so it stays an entity and keeps its own hit()
+            const auto& type = typeid(*leaf);
+            if (type == typeid(sphere)) {
+                items.push_back({primitive_type::sphere, uint32_t(spheres.size()), leaf->bounding_box()});
+                spheres.push_back(static_cast<const sphere&>(*leaf));
+            } else if (type == typeid(quadrilateral)) {
+                items.push_back({primitive_type::quad, uint32_t(quads.size()), leaf->bounding_box()});
+                quads.push_back(static_cast<const quadrilateral&>(*leaf));
+            } else if (type == typeid(cuboid)) {
+                items.push_back({primitive_type::box, uint32_t(boxes.size()), leaf->bounding_box()});
+                boxes.push_back(static_cast<const cuboid&>(*leaf));
+            } else if (type == typeid(pyramid)) {
+                const auto& p = static_cast<const pyramid&>(*leaf);
+                add_triangles(p.triangles(), p.surface_material(), sources, items);
+            } else if (type == typeid(triangular_prism)) {
+                const auto& t = static_cast<const triangular_prism&>(*leaf);
+                add_triangles(t.triangles(), t.surface_material(), sources, items);
+            } else {
+                items.push_back({primitive_type::other, uint32_t(others.size()), leaf->bounding_box()});
+                others.push_back(leaf);
+            }
+        }
+
+        vector<const entity*> candidates;
+        for (const auto& s : spheres) candidates.push_back(&s);
+        for (const auto& q : quads) candidates.push_back(&q);
+        for (auto o : others) candidates.push_back(o);
+        emitters = light_tree(candidates);
+
+        if (items.empty()) {
+            return;
+        }
+        nodes.reserve(2 * items.size());
+        build(items, 0, items.size(), 0);
+
+        // Lay the leaves out: non-triangle references go to refs, triangles of the same leaf are
+        // packed into consecutive triangle blocks.
+        for (auto& n : nodes) {
+            if (!n.is_leaf()) {
+                continue;
+            }
+            size_t first = n.first, count = n.item_count;
+            n.first = uint32_t(refs.size());
+            n.ref_count = 0;
+            n.tri_first_block = uint32_t(triangles.block_count());
+            for (size_t i = first; i < first + count; i++) {
+                const auto& item = items[i];
+                if (item.type == primitive_type::triangle) {
+                    const auto& src = sources[item.index];
+                    triangles.add(src.v0, src.v1, src.v2);
+                    triangle_material.push_back(src.material);
+                } else {
+                    refs.push_back({item.type, item.index});
+                    n.ref_count++;
+                }
+            }
+            triangles.pad_to_block();
+            triangle_material.resize(triangles.size(), 0);
+            n.tri_block_count = uint32_t(triangles.block_count() - n.tri_first_block);
+        }
+    }
+
+    // the light tree and hit records point into the primitive arrays, which a copy or move would
+    // leave behind
+    compiled_scene(const compiled_scene&) = delete;
+    compiled_scene& operator=(const compiled_scene&) = delete;
+    compiled_scene(compiled_scene&&) = delete;
+    compiled_scene& operator=(compiled_scene&&) = delete;
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return nodes.empty() ? axis_aligned_bounding_box::empty : nodes[0].bbox;
+    }
+
+    // the scene's emitting spheres and flat shapes, and any other leaf that describes itself as one
+    [[nodiscard]] const light_tree& lights() const {
+        return emitters;
+    }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const point3& origin = r.origin();
+        const vec3& direction = r.direction();
+        const vec3 inverse(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+        const watertight_ray triangle_ray(r);
+
+        // one pending sibling per level above the current node, plus the root
+        uint32_t stack[max_depth + 1];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        bool hit_anything = false;
+
+        while (stack_size > 0) {
+            const auto& n = nodes[stack[--stack_size]];
+            if (!hit_bbox(n.bbox, origin, inverse, ray_t)) {
+                continue;
+            }
+            if (n.is_leaf()) {
+                for (uint32_t i = n.first; i < n.first + n.ref_count; i++) {
+                    if (hit_primitive(refs[i], r, ray_t, rec)) {
+                        hit_anything = true;
+                        ray_t.max = rec.t;
+                    }
+                }
+                triangle_hit closest;
+                if (n.tri_block_count > 0 &&
+                    triangles.hit_blocks(triangle_ray, ray_t, n.tri_first_block,
+                                         n.tri_first_block + n.tri_block_count, closest)) {
+                    hit_anything = true;
+                    ray_t.max = closest.t;
+                    rec.set_hit(this, closest.t, closest.index, closest.b1, closest.b2);
+                }
+                continue;
+            }
+            // push the far child first so the near one is popped next
+            uint32_t left = uint32_t(&n - nodes.data()) + 1;
+            uint32_t right = n.first;
+            if (direction[n.axis] < 0) {
+                std::swap(left, right);
+            }
+            stack[stack_size++] = right;
+            stack[stack_size++] = left;
+        }
+        return hit_anything;
+    }
+
+    // Only triangles report this scene as their primitive; every other type shades itself.
+    void surface_interaction(const ray& r, entity_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit_vector(triangles.normal(rec.primitive_index)));
+        rec.u = rec.b1;
+        rec.v = rec.b2;
+        rec.materials = materials[triangle_material[rec.primitive_index]];
+    }
+
+    void flatten(vector<const entity*>& leaves) const override {
+        for (const auto& s : spheres) leaves.push_back(&s);
+        for (const auto& q : quads) leaves.push_back(&q);
+        for (const auto& b : boxes) leaves.push_back(&b);
+        for (auto o : others) leaves.push_back(o);
+    }
+
+    // only the leaves kept as entities can be instances
+    [[nodiscard]] int instance_depth() const override {
+        int depth = 0;
+        for (auto o : others) depth = std::max(depth, o->instance_depth());
+        return depth;
+    }
+
+private:
+    enum class primitive_type : uint8_t { sphere, quad, box, triangle, other };
+
+    struct primitive_ref {
+        primitive_type type;
+        uint32_t index;
+    };
+
+    struct build_item {
+        primitive_type type;
+        uint32_t index;
+        axis_aligned_bounding_box bbox;
+
+        double centroid(int axis) const {
+            const auto& i = bbox.axis_of_interval(axis);
+            return 0.5 * (i.min + i.max);
+        }
+    };
+
+    struct triangle_source {
+        point3 v0, v1, v2;
+        uint32_t material;
+    };
+
+    // Interior nodes: left child follows the node, first is the right child. Leaves: refs
+    // [first, first + ref_count) plus triangle blocks [tri_first_block, + tri_block_count).
+    struct node {
+        axis_aligned_bounding_box bbox;
+        uint32_t first = 0;
+        uint32_t tri_first_block = 0;
+        uint16_t ref_count = 0;
+        uint16_t tri_block_count = 0;
+        uint16_t item_count = 0; // build time only
+        uint8_t axis = 0;
+        bool leaf = false;
+
+        bool is_leaf() const { return leaf; }
+    };
+
+    static const size_t max_leaf_size = 4;
+    static const int bin_count = 16;
+    // deepest a leaf can be: SAH splits stop 32 levels short of it, and median splits below them
+    // need at most 30 more levels for 2^32 items in leaves of four
+    static const int max_depth = 64;
+
+    vector<sphere> spheres;
+    vector<quadrilateral> quads;
+    vector<cuboid> boxes;
+    vector<const entity*> others;
+    triangle_soa triangles;
+    vector<uint32_t> triangle_material;
+    material_table materials;
+
+    vector<primitive_ref> refs;
+    vector<node> nodes;
+    light_tree emitters;
+
+    bool hit_primitive(const primitive_ref& ref, const ray& r, const interval& ray_t, entity_record& rec) const {
+        // qualified calls bind statically, the arrays hold exactly these types
+        switch (ref.type) {
+            case primitive_type::sphere: return spheres[ref.index].sphere::hit(r, ray_t, rec);
+            case primitive_type::quad: return quads[ref.index].quadrilateral::hit(r, ray_t, rec);
+            case primitive_type::box: return boxes[ref.index].cuboid::hit(r, ray_t, rec);
+            case primitive_type::other: return others[ref.index]->hit(r, ray_t, rec);
+            default: return false;
+        }
+    }
+
+    static int bin_of(const build_item& item, int axis, const interval& extent) {
+        auto b = int(bin_count * (item.centroid(axis) - extent.min) / extent.size());
+        return b < 0 ? 0 : (b >= bin_count ? bin_count - 1 : b);
+    }
+
+    static double surface_area(const axis_aligned_bounding_box& box) {
+        auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        if (dx < 0 || dy < 0 || dz < 0) {
+            return 0;
+        }
+        if (std::isinf(dx) || std::isinf(dy) || std::isinf(dz)) {
+            return inf;
+        }
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // Slab test with the inverse direction computed once per ray.
+    static bool hit_bbox(const axis_aligned_bounding_box& box, const point3& origin, const vec3& inverse, interval ray_t) {
+        for (int a = 0; a < 3; a++) {
+            const interval& axis = box.axis_of_interval(a);
+            auto t0 = (axis.min - origin[a]) * inverse[a];
+            auto t1 = (axis.max - origin[a]) * inverse[a];
+            if (inverse[a] < 0) {
+                std::swap(t0, t1);
+            }
+            if (t0 > ray_t.min) {
+                ray_t.min = t0;
+            }
+            if (t1 < ray_t.max) {
+                ray_t.max = t1;
+            }
+            if (ray_t.max <= ray_t.min) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void add_triangles(const triangle_soa& source, const shared_ptr<material>& m,
+                       vector<triangle_source>& sources, vector<build_item>& items) {
+        auto material_index = materials.add(m);
+        for (size_t i = 0; i < source.size(); i++) {
+            triangle_source tri{source.vertex(i, 0), source.vertex(i, 1), source.vertex(i, 2), material_index};
+            auto bbox = axis_aligned_bounding_box(axis_aligned_bounding_box(tri.v0, tri.v1),
+                                                  axis_aligned_bounding_box(tri.v1, tri.v2));
+            items.push_back({primitive_type::triangle, uint32_t(sources.size()), bbox});
+            sources.push_back(tri);
+        }
+    }
+
+    uint32_t build(vector<build_item>& items, size_t start, size_t end, int depth) {
+        uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        auto bbox = axis_aligned_bounding_box::empty;
+        auto centroids = axis_aligned_bounding_box::empty;
+        for (size_t i = start; i < end; i++) {
+            bbox = axis_aligned_bounding_box(bbox, items[i].bbox);
+            point3 c(items[i].centroid(0), items[i].centroid(1), items[i].centroid(2));
+            centroids = axis_aligned_bounding_box(centroids, axis_aligned_bounding_box(c, c));
+        }
+        nodes[index].bbox = bbox;
+
+        size_t len = end - start;
+        if (len <= max_leaf_size) {
+            nodes[index].leaf = true;
+            nodes[index].first = uint32_t(start);
+            nodes[index].item_count = uint16_t(len);
+            return index;
+        }
+
+        // Binned surface area heuristic. Scenes mix huge primitives (ground spheres, walls, haze
+        // boundaries) with small ones, and a plain median split drags the huge boxes into every
+        // subtree; SAH keeps them near the root instead. SAH can peel off a few items per level,
+        // so deep trees fall back to median splits to keep within the traversal stack.
+        int axis = centroids.longest_axis();
+        size_t mid = start;
+        double best_cost = inf;
+        int best_bin = 0;
+        for (int a = 0; a < 3 && depth < max_depth - 32; a++) {
+            const auto& extent = centroids.axis_of_interval(a);
+            if (extent.size() <= 0) {
+                continue;
+            }
+            axis_aligned_bounding_box bin_bbox[bin_count];
+            size_t bin_items[bin_count] = {};
+            for (int b = 0; b < bin_count; b++) {
+                bin_bbox[b] = axis_aligned_bounding_box::empty;
+            }
+            for (size_t i = start; i < end; i++) {
+                int b = bin_of(items[i], a, extent);
+                bin_items[b]++;
+                bin_bbox[b] = axis_aligned_bounding_box(bin_bbox[b], items[i].bbox);
+            }
+
+            // sweep from the right to get the cost of everything above each split
+            double right_area[bin_count];
+            size_t right_items[bin_count];
+            auto accumulated = axis_aligned_bounding_box::empty;
+            size_t accumulated_items = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                accumulated = axis_aligned_bounding_box(accumulated, bin_bbox[b]);
+                accumulated_items += bin_items[b];
+                right_area[b] = surface_area(accumulated);
+                right_items[b] = accumulated_items;
+            }
+            accumulated = axis_aligned_bounding_box::empty;
+            accumulated_items = 0;
+            for (int b = 1; b < bin_count; b++) {
+                accumulated = axis_aligned_bounding_box(accumulated, bin_bbox[b - 1]);
+                accumulated_items += bin_items[b - 1];
+                if (accumulated_items == 0 || right_items[b] == 0) {
+                    continue;
+                }
+                double cost = surface_area(accumulated) * double(accumulated_items) + right_area[b] * double(right_items[b]);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    axis = a;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if (best_cost < inf) {
+            const auto& extent = centroids.axis_of_interval(axis);
+            mid = size_t(std::partition(items.begin() + start, items.begin() + end,
+                                        [&](const build_item& item) { return bin_of(item, axis, extent) < best_bin; })
+                         - items.begin());
+        }
+        if (mid == start || mid == end) {
+            // too deep, or every centroid in one spot: fall back to a median split
+            mid = start + len / 2;
+            std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                             [axis](const build_item& a, const build_item& b) { return a.centroid(axis) < b.centroid(axis); });
+        }
+
+        nodes[index].axis = uint8_t(axis);
+        build(items, start, mid, depth + 1);
+        auto right = build(items, mid, end, depth + 1);
+        nodes[index].first = right;
+        return index;
+    }
+};
+
+#endif //GRAPHICA_COMPILED_SCENE_H
@@ -15,6 +15,16 @@
 
 using namespace std;
 
+// Scalar type of the geometry core (vec3, ray, interval, bounding boxes). Define
+// GRAPHICA_SINGLE_PRECISION to build the renderer in float, which halves the size of BVH nodes,
+// hit records and ray state. The packet kernels, triangle_soa and sphere_set, still store and
+// intersect in double lanes in the float build; only their results are rounded to real.
+#ifdef GRAPHICA_SINGLE_PRECISION
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 const double inf = numeric_limits<double>::infinity();
 const double pi = 3.141592652589793238462643383279;
@@ -0,0 +1,120 @@
+//
+// Created by Aryan Singh on 6/14/24.
+//
+
+#ifndef GRAPHICA_CUBOID_H
+#define GRAPHICA_CUBOID_H
+
+#include "constants.h"
+#include "entity.h"
+
+// Axis-aligned box intersected with a single slab test. The face that was hit is the slab axis that
+// produced the entry distance (or the exit distance when the ray starts inside), so the normal and
+// uv come straight from that axis instead of from six separate quadrilaterals.
+class cuboid : public entity {
+public:
+    cuboid(const point3& a, const point3& b, shared_ptr<material> materials) : materials(materials) {
+        min = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
+        max = point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()));
+        extent = max - min;
+        bbox = axis_aligned_bounding_box(min, max);
+    }
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return bbox;
+    }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        const point3& origin = r.origin();
+        const vec3& direction = r.direction();
+
+        real t_near = -inf, t_far = inf;
+        int near_axis = 0, far_axis = 0;
+        for (int a = 0; a < 3; a++) {
+            // parallel to this slab: inside it or not at all, without the 0 * inf of an origin on
+            // one of its planes
+            if (direction[a] == 0) {
+                if (origin[a] < min[a] || origin[a] > max[a]) {
+                    return false;
+                }
+                continue;
+            }
+            const real inverse = 1 / direction[a];
+            auto t0 = (min[a] - origin[a]) * inverse;
+            auto t1 = (max[a] - origin[a]) * inverse;
+            if (inverse < 0) {
+                std::swap(t0, t1);
+            }
+            if (t0 > t_near) {
+                t_near = t0;
+                near_axis = a;
+            }
+            if (t1 < t_far) {
+                t_far = t1;
+                far_axis = a;
+            }
+        }
+
+        if (t_near > t_far) {
+            return false;
+        }
+
+        // the face is recorded as 2 * axis + (1 if it is the max side of that axis)
+        if (ray_t.contains(t_near)) {
+            // entered through the face looking back at the ray
+            rec.set_hit(this, t_near, 2 * near_axis + (direction[near_axis] > 0 ? 0 : 1));
+        } else if (ray_t.contains(t_far)) {
+            // leaving through the face the ray points at
+            rec.set_hit(this, t_far, 2 * far_axis + (direction[far_axis] > 0 ? 1 : 0));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void surface_interaction(const ray& r, entity_record& rec) const override {
+        int axis = int(rec.primitive_index / 2);
+        real sign = (rec.primitive_index % 2) ? 1.0 : -1.0;
+
+        rec.p = r.at(rec.t);
+        vec3 outward_normal;
+        outward_normal[axis] = sign;
+        rec.set_face_normal(r, outward_normal);
+        face_uv(min, extent, rec.p, axis, sign, rec.u, rec.v);
+        face_uv_rate(extent, axis, rec.du_dl, rec.dv_dl);
+        rec.materials = materials.get();
+    }
+
+    // Same (u, v) parametrisation the six quadrilaterals of a box used: each face starts at the
+    // corner and edge directions box() passed to its quadrilateral. Also used by heightfield columns.
+    static void face_uv(const point3& min, const vec3& extent, const point3& p, int axis, real sign, real& u, real& v) {
+        auto fx = (p.x() - min.x()) / extent.x();
+        auto fy = (p.y() - min.y()) / extent.y();
+        auto fz = (p.z() - min.z()) / extent.z();
+
+        if (axis == 2) {
+            u = sign > 0 ? fx : 1 - fx; // front / back
+            v = fy;
+        } else if (axis == 0) {
+            u = sign > 0 ? 1 - fz : fz; // right / left
+            v = fy;
+        } else {
+            u = fx;
+            v = sign > 0 ? 1 - fz : fz; // top / bottom
+        }
+    }
+
+    // u and v per unit length on the faces normal to axis
+    static void face_uv_rate(const vec3& extent, int axis, real& du_dl, real& dv_dl) {
+        du_dl = 1 / extent[axis == 2 || axis == 1 ? 0 : 2];
+        dv_dl = 1 / extent[axis == 1 ? 2 : 1];
+    }
+
+private:
+    point3 min, max;
+    vec3 extent;
+    shared_ptr<material> materials;
+    axis_aligned_bounding_box bbox;
+};
+
+#endif //GRAPHICA_CUBOID_H
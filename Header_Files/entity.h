@@ -7,19 +7,66 @@
 #include "ray.h"
 #include "interval.h"
 #include "axis_aligned_bounding_box.h"
+#include <cassert>
+#include <vector>
 
 
 
 class material;
+class medium;
+struct light_bounds;
+class entity;
+class instance;
 
 class entity_record {
 public:
     point3 p;
     vec3 normal;
-    double t{};
+    real t{};
     bool front_face;
-    shared_ptr<material> materials;
-    double u,v;
+    const material* materials = nullptr; // owned by the primitive or scene, never by the record
+    real u,v;
+
+    // hit() only records which primitive produced the closest intersection and where on it; p,
+    // normal, uv and material above are filled in once by resolve_surface() for the final hit.
+    const entity* primitive = nullptr;
+    size_t primitive_index = 0; // sub-primitive of the entity (triangle, sphere of a set, box face)
+    real b1 = 0, b2 = 0;        // barycentric / parametric coordinates of the hit
+
+    // Change of u and v per unit of distance across the surface at p, from surface_interaction();
+    // 0 where a primitive does not know it. footprint is the width of the ray cone where it meets
+    // the surface, set by the integrator. Together they size filtered texture lookups.
+    real du_dl = 0, dv_dl = 0;
+    real footprint = 0;
+
+    // Medium enclosed by the surface that was hit, for surfaces that bound one (see volumes);
+    // pass_through marks boundaries that are not visible surfaces and only change the medium.
+    const medium* interior = nullptr;
+    bool pass_through = false;
+
+    // instances the ray passed through to reach the primitive, innermost first; transform refuses
+    // to be built over anything that would nest them deeper
+    static const int max_instance_depth = 8;
+    const instance* instances[max_instance_depth];
+    int instance_count = 0;
+
+    void set_hit(const entity* hit_primitive, real hit_t, size_t index = 0, real hit_b1 = 0, real hit_b2 = 0) {
+        t = hit_t;
+        primitive = hit_primitive;
+        primitive_index = index;
+        b1 = hit_b1;
+        b2 = hit_b2;
+        instance_count = 0;
+        interior = nullptr;
+        pass_through = false;
+    }
+
+    void push_instance(const instance* inst) {
+        assert(instance_count < max_instance_depth && "instances nested deeper than max_instance_depth");
+        if (instance_count < max_instance_depth) {
+            instances[instance_count++] = inst;
+        }
+    }
 
     void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Checking if ray is inside object or outisde object
@@ -31,7 +78,18 @@ public:
 class entity {
 public:
     virtual ~entity() = default;
+
+    // Finds the closest intersection inside ray_t. Implementations only write to rec when they
+    // report a hit, and then only through set_hit(); everything else is deferred to
+    // surface_interaction() so candidates that get replaced by a closer hit cost nothing extra.
     virtual bool hit(const ray& r, interval ray_t, entity_record& rec) const=0;
+
+    // Fills p, normal, front_face, u, v and materials for a hit this entity reported through
+    // set_hit(). r is the ray in the entity's own space.
+    virtual void surface_interaction(const ray& r, entity_record& rec) const {
+        rec.p = r.at(rec.t);
+    }
+
     [[nodiscard]] virtual axis_aligned_bounding_box bounding_box() const = 0;
     virtual double pdf_value(const point3& origin, const vec3& direction) const {
         return 0.0;
@@ -41,119 +99,56 @@ public:
         return vec3(1, 0, 0);
     }
 
-};
-
-// move ray back by offset, check intersection, move ray towards offset again
-class translate : public entity {
-public:
-
-    translate(shared_ptr<entity> obj, const vec3& offset) : obj(obj), offset(offset) {
-        bbox = obj->bounding_box() + offset;
+    // Describes the entity as a light for many-light sampling (see light_tree). Entities that emit
+    // nothing, or whose pdf_value() and random() cannot sample them, return false.
+    virtual bool emitter_bounds(light_bounds& light) const {
+        return false;
     }
 
-    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
-        // move ray back by offset
-        ray offset_back(r.origin() - offset, r.direction(), r.time());
-
-        // check intersection
-        if (!obj->hit(offset_back, ray_t, rec)) {
-            return false;
-        }
-
-        // move ray towards offset again
-        rec.p += offset;
-        return true;
+    // Area of the surface, over which sample_surface() is uniform; zero for entities it cannot
+    // sample.
+    [[nodiscard]] virtual double surface_area() const {
+        return 0;
     }
 
-    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
-        return bbox;
+    // Samples a point uniformly over the surface, for paths that start on a light: fills p, the
+    // outward normal (front_face set), uv and material of rec. Returns false if it cannot.
+    virtual bool sample_surface(entity_record& rec) const {
+        return false;
     }
-private:
-    vec3 offset;
-    shared_ptr<entity> obj;
-    axis_aligned_bounding_box bbox;
-};
-
-class rotate_y : public entity {
-public:
-
-    rotate_y(shared_ptr<entity> obj, double angle) : obj(obj) {
-        auto radians = deg_to_rad(angle);
-        cos_theta = cos(radians);
-        sin_theta = sin(radians);
-        bbox = obj->bounding_box();
-
-        // get rotated bounding box
-        point3 max(-inf, -inf, -inf);
-        point3 min(inf, inf, inf);
-
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 2; j++) {
-                for (int k = 0; k < 2; k++) {
-                    auto x = i * bbox.x.max + (i-1) * bbox.x.min;
-                    auto y = j * bbox.y.max + (j-1) * bbox.y.min;
-                    auto z = k * bbox.z.max + (k-1) * bbox.z.min;
-
-                    auto new_x = cos_theta*x + sin_theta*z;
-                    auto new_z = -sin_theta*x + cos_theta*z;
-
-                    vec3 check(new_x, y, new_z);
-
-                    for (int component = 0; component < 2; component++) {
-                        min[component] = fmin(min[component], check[component]);
-                        max[component] = fmax(max[component], check[component]);
-                    }
-                }
-            }
-        }
-
-        bbox = axis_aligned_bounding_box(min, max);
 
+    // Most instances (see instance) met on the way from this entity down to any primitive.
+    [[nodiscard]] virtual int instance_depth() const {
+        return 0;
     }
-    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
-        auto origin = r.origin();
-        auto dir = r.direction();
-
-        auto original_origin = origin;
-        auto original_dir = dir;
-
-        // rotate to new coords
-        origin[0] = cos_theta * original_origin[0] - sin_theta * original_origin[2];
-        origin[2] = sin_theta * original_origin[0] + cos_theta * original_origin[2];
 
-        dir[0] = cos_theta * original_dir[0] - sin_theta * original_dir[2];
-        dir[2] = sin_theta * original_dir[0] + cos_theta * original_dir[2];
+    // Appends the entities this one is made of. Containers (lists, BVHs) forward to their
+    // children so a scene can be flattened into its primitives; everything else is a leaf.
+    virtual void flatten(vector<const entity*>& leaves) const {
+        leaves.push_back(this);
+    }
 
-        ray rotated_ray(origin, dir, r.time());
+};
 
-        if (!obj->hit(rotated_ray, ray_t, rec)) {
-            return false; // no intersection
-        }
+// An entity that places another entity in the scene through a change of coordinates. The wrapped
+// entity is intersected in its own space, and the hit is carried back to world space only after
+// the final surface interaction has been computed.
+class instance : public entity {
+public:
+    virtual ray to_object(const ray& r) const = 0;
+    virtual void to_world(entity_record& rec) const = 0;
+};
 
-        // rotate back
-        auto p = rec.p;
-        auto original_p = p;
-        p[0] = cos_theta * original_p[0] + sin_theta * original_p[2];
-        p[2] = -sin_theta * original_p[0] + cos_theta * original_p[2];
-
-        // change normal back
-        auto n = rec.normal;
-        auto original_normal = n;
-        n[0] = cos_theta * original_normal[0] + sin_theta * original_normal[2];
-        n[2] = -sin_theta * original_normal[0] + cos_theta * original_normal[2];
-
-        rec.p = p;
-        rec.normal = n;
-        return true;
+// Completes the record for the closest hit found by entity::hit().
+inline void resolve_surface(const ray& r, entity_record& rec) {
+    ray local = r;
+    for (int i = rec.instance_count - 1; i >= 0; i--) {
+        local = rec.instances[i]->to_object(local);
     }
-
-    axis_aligned_bounding_box bounding_box() const override {
-        return bbox;
+    rec.primitive->surface_interaction(local, rec);
+    for (int i = 0; i < rec.instance_count; i++) {
+        rec.instances[i]->to_world(rec);
     }
-private:
-    double cos_theta, sin_theta;
-    axis_aligned_bounding_box bbox;
-    shared_ptr<entity> obj;
-};
+}
 
 #endif //GRAPHICA_ENTITY_H
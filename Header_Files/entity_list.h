@@ -30,21 +30,54 @@ public:
     }
 
     bool hit(const ray& r, interval ray_t, entity_record& record) const override {
-         entity_record temp_record;
+         // objects only write to the record when they find a closer hit, so no temporary is needed
          bool hit_anything = false;
          auto closest_so_far = ray_t.max;
 
          for (const auto& object : objects) {
-             if (object->hit(r, interval(ray_t.min, closest_so_far), temp_record)) {
+             if (object->hit(r, interval(ray_t.min, closest_so_far), record)) {
                  hit_anything = true;
-                 closest_so_far = temp_record.t;
-                 record = temp_record;
+                 closest_so_far = record.t;
              }
          }
 
          return hit_anything;
     }
 
+    // As a set of lights: random() picks one member uniformly, so the density of a direction is
+    // the average of the members' densities.
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        if (objects.empty()) {
+            return 0;
+        }
+        auto sum = 0.0;
+        for (const auto& object : objects) {
+            sum += object->pdf_value(origin, direction);
+        }
+        return sum / double(objects.size());
+    }
+
+    vec3 random(const point3& origin) const override {
+        if (objects.empty()) {
+            return vec3(1, 0, 0);
+        }
+        return objects[random_int(0, int(objects.size()) - 1)]->random(origin);
+    }
+
+    void flatten(vector<const entity*>& leaves) const override {
+        for (const auto& object : objects) {
+            object->flatten(leaves);
+        }
+    }
+
+    [[nodiscard]] int instance_depth() const override {
+        int depth = 0;
+        for (const auto& object : objects) {
+            depth = std::max(depth, object->instance_depth());
+        }
+        return depth;
+    }
+
 private:
     axis_aligned_bounding_box bbox;
 };
@@ -0,0 +1,115 @@
+//
+// Created by Aryan Singh on 6/23/24.
+//
+
+#ifndef GRAPHICA_ENVIRONMENT_LIGHT_H
+#define GRAPHICA_ENVIRONMENT_LIGHT_H
+
+#include "entity.h"
+#include "constants.h"
+#include "color.h"
+#include "image_store.h"
+#include "sampling.h"
+#include <vector>
+
+// Light arriving from infinitely far away in every direction, read from a latitude-longitude
+// image: u runs once around the y axis, with the same seam as sphere uv, and the image's top row
+// is straight up. HDR files keep their full range (image_store reads rtw_image's floats), so a
+// captured sky or studio can light the scene.
+//
+// Directions are importance sampled in proportion to the image's brightness. A piecewise-constant
+// distribution over a grid of at most 1024x512 cells is built at load time from the filtered
+// image, each cell weighted by the solid angle it covers; pdf_value() and random() expose it like
+// any other light. Radiance seen by escaping rays comes from the same cached pyramid, filtered
+// over the ray's cone.
+//
+// It is not part of the world: hit() never reports anything. Give it to the camera instead.
+class environment_light : public entity {
+public:
+    explicit environment_light(const char* image_filename, double intensity = 1.0)
+            : mips(image_store::load(image_filename)), intensity(intensity) {
+        build_distribution();
+    }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        return false;
+    }
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return axis_aligned_bounding_box::empty;
+    }
+
+    // Radiance arriving along -direction, i.e. seen looking towards direction, averaged over a
+    // cone of the given angle. Zero when the image could not be loaded.
+    [[nodiscard]] color value(const vec3& direction, double spread = 0) const {
+        if (mips->empty()) {
+            return color(0,0,0);
+        }
+        double u, t;
+        to_image(unit_vector(direction), u, t);
+        // a cone of angle spread covers spread / 2pi of a row, widened by the row's shrinking
+        // circumference towards the poles, and spread / pi of a column
+        auto sin_theta = sin(pi * t);
+        auto du = fmin(spread / (2 * pi * fmax(sin_theta, 1e-3)), 1.0);
+        auto dv = spread / pi;
+        return intensity * mips->lookup(u, t, du, dv);
+    }
+
+    // Solid angle density of random()
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        double u, t;
+        to_image(unit_vector(direction), u, t);
+        auto sin_theta = sin(pi * t);
+        if (sin_theta <= 0) {
+            return 0;
+        }
+        return distribution.pdf(u, t) / (2 * pi * pi * sin_theta);
+    }
+
+    vec3 random(const point3& origin) const override {
+        double u, t, pdf;
+        distribution.sample(random_double(), random_double(), u, t, pdf);
+        return from_image(u, t);
+    }
+
+private:
+    shared_ptr<const mipmap> mips; // shared with every texture of the same file
+    double intensity;
+    piecewise_constant_2d distribution;
+
+    // u around the y axis as for sphere uv, t from straight up (0) to straight down (1)
+    static void to_image(const vec3& d, double& u, double& t) {
+        u = (atan2(-d.z(), d.x()) + pi) / (2 * pi);
+        t = acos(fmin(fmax(d.y(), -1.0), 1.0)) / pi;
+    }
+
+    static vec3 from_image(double u, double t) {
+        auto theta = pi * t;
+        auto phi = 2 * pi * u - pi;
+        auto sin_theta = sin(theta);
+        return vec3(sin_theta * cos(phi), cos(theta), -sin_theta * sin(phi));
+    }
+
+    void build_distribution() {
+        int width = 1, height = 1;
+        if (!mips->empty()) {
+            width = std::min(mips->width(), 1024);
+            height = std::min(mips->height(), 512);
+        }
+        std::vector<double> weights(size_t(width) * height, 1.0);
+        if (!mips->empty()) {
+            for (int y = 0; y < height; y++) {
+                auto t = (y + 0.5) / height;
+                auto sin_theta = sin(pi * t);
+                for (int x = 0; x < width; x++) {
+                    // the footprint of one cell averages the texels it covers
+                    auto c = mips->lookup((x + 0.5) / width, t, 1.0 / width, 1.0 / height);
+                    weights[size_t(y) * width + x] = fmax(luminance(c), 0.0) * sin_theta;
+                }
+            }
+        }
+        distribution = piecewise_constant_2d(weights, width, height);
+    }
+};
+
+#endif //GRAPHICA_ENVIRONMENT_LIGHT_H
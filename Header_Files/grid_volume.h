@@ -0,0 +1,294 @@
+//
+// Created by Aryan Singh on 6/21/24.
+//
+
+#ifndef GRAPHICA_GRID_VOLUME_H
+#define GRAPHICA_GRID_VOLUME_H
+
+#include "entity.h"
+#include "constants.h"
+#include "texture.h"
+#include "material.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Participating medium whose density varies over an axis-aligned box. Density is given at the
+// points of a regular lattice spanning the box and interpolated trilinearly in between; it is
+// multiplied by density_scale to give the extinction coefficient per unit of distance.
+//
+// The lattice is stored in 8x8x8 bricks. With sparse storage, bricks whose points are all zero
+// share one empty brick, so smoke filling a fraction of its box costs memory for that fraction.
+//
+// Free paths are sampled by delta tracking (Woodcock): tentative collisions are drawn against a
+// majorant, the largest density over a region, and each is accepted as real with probability
+// density / majorant. Majorants are kept per brick rather than for the whole box, and the ray
+// walks the bricks in order, so empty bricks are skipped in one step and thin ones take long
+// tentative steps instead of being paced by the densest part of the volume.
+class grid_volume : public entity {
+public:
+    static const int brick_size = 8;
+
+    enum class storage { dense, sparse };
+
+    // densities holds nx * ny * nz lattice points, x fastest, with nx, ny, nz >= 2.
+    grid_volume(const axis_aligned_bounding_box& region, int nx, int ny, int nz, const std::vector<float>& densities,
+                double density_scale, const color& albedo, storage layout = storage::sparse)
+            : region(region), density_scale(density_scale), phase_function(make_shared<isotropic>(albedo)) {
+        origin = point3(region.x.min, region.y.min, region.z.min);
+        int counts[3] = {nx, ny, nz};
+        for (int a = 0; a < 3; a++) {
+            points[a] = std::max(counts[a], 2);
+            cells[a] = (points[a] - 2) / brick_size + 1; // bricks covering points[a] - 1 lattice cells
+            bricks[a] = (points[a] + brick_size - 1) / brick_size;
+            auto extent = region.axis_of_interval(a).size();
+            spacing[a] = extent / (points[a] - 1);
+            inverse_spacing[a] = 1 / spacing[a];
+        }
+        store(densities, layout);
+        build_majorants();
+
+        std::clog << "Grid volume: " << points[0] << "x" << points[1] << "x" << points[2] << " points, "
+                  << stored_bricks << " of " << brick_index.size() << " bricks stored, "
+                  << texels.size() * sizeof(float) / (1024.0 * 1024.0) << " MiB, majorant grid "
+                  << cells[0] << "x" << cells[1] << "x" << cells[2] << "\n";
+    }
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return region;
+    }
+
+    // Trilinear density (before density_scale) at world space point p; zero outside the box.
+    [[nodiscard]] double density(const point3& p) const {
+        auto g = (p - origin);
+        return lattice_density(g.x() * inverse_spacing.x(), g.y() * inverse_spacing.y(), g.z() * inverse_spacing.z());
+    }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        double hit_t = 0;
+        bool collided = false;
+        traverse(r, ray_t, [&](const double* o, const double* d, double t, double t_exit, double majorant, double scale) {
+            while (true) {
+                t -= log(1 - random_double()) / majorant;
+                if (t >= t_exit) {
+                    return false;
+                }
+                auto sigma = lattice_density(o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2]);
+                if (random_double() * majorant < sigma * scale) {
+                    hit_t = t;
+                    collided = true;
+                    return true;
+                }
+            }
+        });
+        if (!collided) {
+            return false;
+        }
+        rec.set_hit(this, hit_t);
+        return true;
+    }
+
+    void surface_interaction(const ray& r, entity_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.normal = vec3(1,0,0);
+        rec.front_face = true;
+        rec.materials = phase_function.get();
+    }
+
+    // Fraction of light that crosses the volume along r within ray_t, estimated without bias by
+    // ratio tracking: the same tentative collisions as hit(), each scaling the estimate by the
+    // chance it was a null collision instead of ending the walk.
+    [[nodiscard]] double transmittance(const ray& r, interval ray_t) const {
+        double estimate = 1;
+        traverse(r, ray_t, [&](const double* o, const double* d, double t, double t_exit, double majorant, double scale) {
+            while (true) {
+                t -= log(1 - random_double()) / majorant;
+                if (t >= t_exit) {
+                    return false;
+                }
+                auto sigma = lattice_density(o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2]);
+                estimate *= 1 - sigma * scale / majorant;
+                if (estimate <= 0) {
+                    estimate = 0;
+                    return true;
+                }
+            }
+        });
+        return estimate;
+    }
+
+private:
+    axis_aligned_bounding_box region;
+    point3 origin;
+    vec3 spacing, inverse_spacing;
+    double density_scale;
+    shared_ptr<material> phase_function;
+
+    int points[3];
+    int bricks[3];
+    int cells[3]; // majorant cells, one per brick of lattice cells
+    std::vector<uint32_t> brick_index; // offset of each brick's points in texels
+    std::vector<float> texels;
+    std::vector<float> majorants;
+    size_t stored_bricks = 0;
+
+    static const int brick_volume = brick_size * brick_size * brick_size;
+
+    void store(const std::vector<float>& densities, storage layout) {
+        brick_index.assign(size_t(bricks[0]) * bricks[1] * bricks[2], 0);
+        if (layout == storage::sparse) {
+            texels.assign(brick_volume, 0.0f); // brick 0 is the shared empty brick
+        }
+        std::vector<float> brick(brick_volume);
+        for (int bz = 0; bz < bricks[2]; bz++) {
+            for (int by = 0; by < bricks[1]; by++) {
+                for (int bx = 0; bx < bricks[0]; bx++) {
+                    bool empty = true;
+                    for (int k = 0; k < brick_size; k++) {
+                        for (int j = 0; j < brick_size; j++) {
+                            for (int i = 0; i < brick_size; i++) {
+                                int x = bx * brick_size + i, y = by * brick_size + j, z = bz * brick_size + k;
+                                float value = 0;
+                                if (x < points[0] && y < points[1] && z < points[2]) {
+                                    value = fmax(densities[(size_t(z) * points[1] + y) * points[0] + x], 0.0f);
+                                }
+                                brick[(k * brick_size + j) * brick_size + i] = value;
+                                empty = empty && value == 0;
+                            }
+                        }
+                    }
+                    size_t b = (size_t(bz) * bricks[1] + by) * bricks[0] + bx;
+                    if (empty && layout == storage::sparse) {
+                        continue;
+                    }
+                    brick_index[b] = uint32_t(texels.size());
+                    texels.insert(texels.end(), brick.begin(), brick.end());
+                    stored_bricks++;
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] float point_density(int x, int y, int z) const {
+        size_t b = (size_t(z / brick_size) * bricks[1] + y / brick_size) * bricks[0] + x / brick_size;
+        int inside = ((z % brick_size) * brick_size + y % brick_size) * brick_size + x % brick_size;
+        return texels[brick_index[b] + inside];
+    }
+
+    // density at lattice coordinates (x, y, z), i.e. in units of the point spacing from origin
+    [[nodiscard]] double lattice_density(double x, double y, double z) const {
+        if (!(x >= 0 && y >= 0 && z >= 0 && x <= points[0] - 1 && y <= points[1] - 1 && z <= points[2] - 1)) {
+            return 0;
+        }
+        int i = std::min(int(x), points[0] - 2);
+        int j = std::min(int(y), points[1] - 2);
+        int k = std::min(int(z), points[2] - 2);
+        double fx = x - i, fy = y - j, fz = z - k;
+
+        auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+        auto near_plane = lerp(lerp(point_density(i, j, k), point_density(i + 1, j, k), fx),
+                               lerp(point_density(i, j + 1, k), point_density(i + 1, j + 1, k), fx), fy);
+        auto far_plane = lerp(lerp(point_density(i, j, k + 1), point_density(i + 1, j, k + 1), fx),
+                              lerp(point_density(i, j + 1, k + 1), point_density(i + 1, j + 1, k + 1), fx), fy);
+        return lerp(near_plane, far_plane, fz);
+    }
+
+    // Trilinear interpolation never exceeds its corners, so the majorant of a cell is the largest
+    // of the lattice points on or inside its boundary.
+    void build_majorants() {
+        majorants.assign(size_t(cells[0]) * cells[1] * cells[2], 0.0f);
+        for (int cz = 0; cz < cells[2]; cz++) {
+            for (int cy = 0; cy < cells[1]; cy++) {
+                for (int cx = 0; cx < cells[0]; cx++) {
+                    float largest = 0;
+                    for (int z = cz * brick_size; z <= std::min((cz + 1) * brick_size, points[2] - 1); z++) {
+                        for (int y = cy * brick_size; y <= std::min((cy + 1) * brick_size, points[1] - 1); y++) {
+                            for (int x = cx * brick_size; x <= std::min((cx + 1) * brick_size, points[0] - 1); x++) {
+                                largest = std::max(largest, point_density(x, y, z));
+                            }
+                        }
+                    }
+                    majorants[(size_t(cz) * cells[1] + cy) * cells[0] + cx] = largest;
+                }
+            }
+        }
+    }
+
+    // Walks the majorant cells the ray crosses inside ray_t, front to back (Amanatides and Woo),
+    // calling visit(o, d, t_entry, t_exit, majorant, scale) for each cell with a non-zero majorant.
+    // o and d are the ray in lattice coordinates, scale turns lattice densities into extinction per
+    // unit of ray parameter and the majorant is already scaled. visit returns true to stop the walk.
+    template<typename Visit>
+    void traverse(const ray& r, interval ray_t, Visit&& visit) const {
+        double o[3], d[3];
+        double t_min = ray_t.min, t_max = ray_t.max;
+        for (int a = 0; a < 3; a++) {
+            o[a] = (r.origin()[a] - origin[a]) * inverse_spacing[a];
+            d[a] = r.direction()[a] * inverse_spacing[a];
+            // clip against the lattice box [0, points - 1]; parallel to an axis the ray is inside
+            // that slab or misses, without the 0 * inf of an origin on one of its planes
+            if (d[a] == 0) {
+                if (o[a] < 0 || o[a] > points[a] - 1) {
+                    return;
+                }
+                continue;
+            }
+            auto inverse = 1 / d[a];
+            auto t0 = (0 - o[a]) * inverse;
+            auto t1 = (points[a] - 1 - o[a]) * inverse;
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            t_min = fmax(t_min, t0);
+            t_max = fmin(t_max, t1);
+        }
+        if (!(t_min < t_max)) {
+            return;
+        }
+        // lattice densities to extinction per unit of ray parameter
+        auto scale = density_scale * r.direction().length();
+
+        int cell[3], step[3], end[3];
+        double t_next[3], t_delta[3];
+        for (int a = 0; a < 3; a++) {
+            auto entry = o[a] + t_min * d[a];
+            cell[a] = std::clamp(int(entry / brick_size), 0, cells[a] - 1);
+            if (d[a] > 0) {
+                step[a] = 1;
+                end[a] = cells[a];
+                t_next[a] = ((cell[a] + 1) * brick_size - o[a]) / d[a];
+                t_delta[a] = brick_size / d[a];
+            } else if (d[a] < 0) {
+                step[a] = -1;
+                end[a] = -1;
+                t_next[a] = (cell[a] * brick_size - o[a]) / d[a];
+                t_delta[a] = -brick_size / d[a];
+            } else {
+                step[a] = 0;
+                end[a] = -1;
+                t_next[a] = inf;
+                t_delta[a] = inf;
+            }
+        }
+
+        auto t = t_min;
+        while (t < t_max) {
+            int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            auto t_exit = fmin(t_next[axis], t_max);
+            auto majorant = majorants[(size_t(cell[2]) * cells[1] + cell[1]) * cells[0] + cell[0]] * scale;
+            if (majorant > 0 && t_exit > t) {
+                if (visit(o, d, t, t_exit, majorant, scale)) {
+                    return;
+                }
+            }
+            t = t_exit;
+            cell[axis] += step[axis];
+            if (cell[axis] == end[axis]) {
+                return;
+            }
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
+
+#endif //GRAPHICA_GRID_VOLUME_H
@@ -0,0 +1,270 @@
+//
+// Created by Aryan Singh on 6/16/24.
+//
+
+#ifndef GRAPHICA_HEIGHTFIELD_H
+#define GRAPHICA_HEIGHTFIELD_H
+
+#include "constants.h"
+#include "entity.h"
+#include "cuboid.h"
+#include "rtw_image.h"
+#include <algorithm>
+#include <vector>
+
+// Regular grid of columns standing on a common base, e.g. terrain or the extruded ground of
+// final_scene. Column (i, k) covers [i, i+1) x [k, k+1) cells of the grid and rises from the base
+// to its height, so it is the same solid as a box() there but costs one height per cell.
+//
+// Rays walk the grid with a 2D DDA. On top of the heights sits a max pyramid: every level stores
+// the tallest column of each tile_size x tile_size block of the level below. The walk starts on
+// the coarsest level and only descends into tiles the ray passes low enough to touch, so rays over
+// open terrain step over whole tiles at once. Since columns always reach down to the base, the
+// per-tile minimum never rules a tile out and is not stored.
+class heightfield : public entity {
+public:
+    static const int tile_size = 8;
+
+    // heights[k * nx + i] is the top of the column over cell i along x and k along z. corner is the
+    // minimum corner of the grid and its y the base of every column.
+    heightfield(const point3& corner, real cell_width, real cell_depth, int nx, int nz,
+                std::vector<real> heights, shared_ptr<material> materials)
+            : corner(corner), cell_width(cell_width), cell_depth(cell_depth), materials(materials) {
+        levels.push_back({nx, nz, cell_width, cell_depth, std::move(heights)});
+        build_pyramid();
+    }
+
+    // One cell per pixel of a height image, the average of its channels scaled to size.y(). The
+    // grid spans size.x() by size.z() from corner.
+    heightfield(const char* image_filename, const point3& corner, const vec3& size, shared_ptr<material> materials)
+            : heightfield(rtw_image(image_filename), corner, size, materials) {}
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return bbox;
+    }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        if (levels[0].max.empty()) {
+            return false;
+        }
+        walk_state s{r.origin(), r.direction(), vec3(1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z()),
+                     ray_t, rec};
+
+        // clip the ray to the grid, remembering which side it came in through
+        real t0 = ray_t.min, t1 = ray_t.max;
+        int entry_axis = -1;
+        for (int a = 0; a < 3; a++) {
+            const interval& slab = bbox.axis_of_interval(a);
+            auto near = (slab.min - s.origin[a]) * s.inverse[a];
+            auto far = (slab.max - s.origin[a]) * s.inverse[a];
+            if (s.inverse[a] < 0) {
+                std::swap(near, far);
+            }
+            if (near > t0) {
+                t0 = near;
+                entry_axis = a;
+            }
+            if (far < t1) {
+                t1 = far;
+            }
+        }
+        if (t0 > t1) {
+            return false;
+        }
+
+        const auto& top = levels.back();
+        return walk(s, int(levels.size()) - 1, 0, top.nx, 0, top.nz, t0, t1, entry_axis);
+    }
+
+    void surface_interaction(const ray& r, entity_record& rec) const override {
+        size_t cell = rec.primitive_index / 6;
+        int face = int(rec.primitive_index % 6);
+        int axis = face / 2;
+        real sign = (face % 2) ? 1.0 : -1.0;
+        int i = int(cell % levels[0].nx);
+        int k = int(cell / levels[0].nx);
+
+        point3 min(corner.x() + i * cell_width, corner.y(), corner.z() + k * cell_depth);
+        vec3 extent(cell_width, levels[0].max[cell] - corner.y(), cell_depth);
+
+        rec.p = r.at(rec.t);
+        vec3 outward_normal;
+        outward_normal[axis] = sign;
+        rec.set_face_normal(r, outward_normal);
+        cuboid::face_uv(min, extent, rec.p, axis, sign, rec.u, rec.v);
+        cuboid::face_uv_rate(extent, axis, rec.du_dl, rec.dv_dl);
+        rec.materials = materials.get();
+    }
+
+private:
+    // level 0 holds the column heights, level l + 1 the maximum of each tile of level l
+    struct level {
+        int nx, nz;
+        real width, depth; // extent of one cell of this level
+        std::vector<real> max;
+    };
+
+    struct walk_state {
+        point3 origin;
+        vec3 direction;
+        vec3 inverse;
+        const interval& ray_t;
+        entity_record& rec;
+    };
+
+    point3 corner;
+    real cell_width, cell_depth;
+    std::vector<level> levels;
+    shared_ptr<material> materials;
+    axis_aligned_bounding_box bbox;
+
+    heightfield(const rtw_image& image, const point3& corner, const vec3& size, shared_ptr<material> materials)
+            : heightfield(corner, size.x() / std::max(1, image.width()), size.z() / std::max(1, image.height()),
+                          image.width(), image.height(), image_heights(image, corner.y(), size.y()), materials) {}
+
+    static std::vector<real> image_heights(const rtw_image& image, real base, real scale) {
+        std::vector<real> heights(size_t(image.width()) * image.height());
+        for (int k = 0; k < image.height(); k++) {
+            for (int i = 0; i < image.width(); i++) {
+                auto pixel = image.pixel_data(i, k);
+                heights[size_t(k) * image.width() + i] = base + scale * (pixel[0] + pixel[1] + pixel[2]) / (3 * 255.0);
+            }
+        }
+        return heights;
+    }
+
+    void build_pyramid() {
+        while (levels.back().nx > tile_size || levels.back().nz > tile_size) {
+            const auto& fine = levels.back();
+            level coarse{(fine.nx + tile_size - 1) / tile_size, (fine.nz + tile_size - 1) / tile_size,
+                         fine.width * tile_size, fine.depth * tile_size, {}};
+            coarse.max.assign(size_t(coarse.nx) * coarse.nz, -inf);
+            for (int k = 0; k < fine.nz; k++) {
+                for (int i = 0; i < fine.nx; i++) {
+                    auto& tile = coarse.max[size_t(k / tile_size) * coarse.nx + i / tile_size];
+                    tile = std::max(tile, fine.max[size_t(k) * fine.nx + i]);
+                }
+            }
+            levels.push_back(std::move(coarse));
+        }
+
+        const auto& top = levels.back();
+        real highest = corner.y();
+        for (auto h : top.max) {
+            highest = std::max(highest, h);
+        }
+        bbox = axis_aligned_bounding_box(corner, point3(corner.x() + levels[0].nx * cell_width, highest,
+                                                        corner.z() + levels[0].nz * cell_depth));
+    }
+
+    // 2D DDA over cells [i_first, i_last) x [k_first, k_last) of a level for the ray segment [t0, t1],
+    // visiting them front to back. entry_axis is the axis of the face the segment starts on, -1 when
+    // it starts at the ray origin.
+    bool walk(const walk_state& s, int l, int i_first, int i_last, int k_first, int k_last,
+              real t0, real t1, int entry_axis) const {
+        const auto& lv = levels[l];
+        auto p = s.origin + t0 * s.direction;
+        int i = std::clamp(int(floor((p.x() - corner.x()) / lv.width)), i_first, i_last - 1);
+        int k = std::clamp(int(floor((p.z() - corner.z()) / lv.depth)), k_first, k_last - 1);
+        int step_i = s.direction.x() > 0 ? 1 : -1;
+        int step_k = s.direction.z() > 0 ? 1 : -1;
+
+        // distance to the cell wall ahead of the ray on each axis
+        auto next_x = [&] {
+            if (s.direction.x() == 0) return real(inf);
+            return (corner.x() + (i + (step_i > 0)) * lv.width - s.origin.x()) * s.inverse.x();
+        };
+        auto next_z = [&] {
+            if (s.direction.z() == 0) return real(inf);
+            return (corner.z() + (k + (step_k > 0)) * lv.depth - s.origin.z()) * s.inverse.z();
+        };
+
+        real t = t0;
+        int axis = entry_axis;
+        while (true) {
+            auto tx = next_x();
+            auto tz = next_z();
+            auto t_exit = std::min(std::min(tx, tz), t1);
+            if (visit(s, l, i, k, t, t_exit, axis)) {
+                return true;
+            }
+            if (t_exit >= t1) {
+                return false;
+            }
+            if (tx <= tz) {
+                i += step_i;
+                axis = 0;
+                t = tx;
+            } else {
+                k += step_k;
+                axis = 2;
+                t = tz;
+            }
+            if (i < i_first || i >= i_last || k < k_first || k >= k_last) {
+                return false;
+            }
+        }
+    }
+
+    // A cell of a coarse level is skipped unless the ray dips to its maximum height inside it; a
+    // level 0 cell is intersected with its column.
+    bool visit(const walk_state& s, int l, int i, int k, real t0, real t1, int entry_axis) const {
+        const auto& lv = levels[l];
+        real top = lv.max[size_t(k) * lv.nx + i];
+        if (top <= corner.y()) {
+            return false;
+        }
+        // the segment is straight, so its lowest point is at one of its ends
+        auto y0 = s.origin.y() + t0 * s.direction.y();
+        auto y1 = s.origin.y() + t1 * s.direction.y();
+        if (std::min(y0, y1) > top) {
+            return false;
+        }
+        if (l > 0) {
+            return walk(s, l - 1, i * tile_size, std::min((i + 1) * tile_size, levels[l - 1].nx),
+                        k * tile_size, std::min((k + 1) * tile_size, levels[l - 1].nz), t0, t1, entry_axis);
+        }
+
+        // column [base, top] over the cell, faces encoded like cuboid: 2 * axis + (1 if max side)
+        auto ty0 = (corner.y() - s.origin.y()) * s.inverse.y();
+        auto ty1 = (top - s.origin.y()) * s.inverse.y();
+        if (s.inverse.y() < 0) {
+            std::swap(ty0, ty1);
+        }
+        real near = t0, far = t1;
+        int near_face = entry_axis < 0 ? -1 : 2 * entry_axis + (s.direction[entry_axis] > 0 ? 0 : 1);
+        int far_face = -1;
+        if (ty0 > near) {
+            near = ty0;
+            near_face = 2 + (s.direction.y() > 0 ? 0 : 1);
+        }
+        if (ty1 <= far) {
+            far = ty1;
+            far_face = 2 + (s.direction.y() > 0 ? 1 : 0);
+        }
+        if (near > far) {
+            return false;
+        }
+
+        size_t cell = size_t(k) * lv.nx + i;
+        if (near_face >= 0 && s.ray_t.contains(near)) {
+            s.rec.set_hit(this, near, cell * 6 + near_face);
+            return true;
+        }
+        if (!s.ray_t.contains(far)) {
+            return false;
+        }
+        if (far_face < 0) {
+            // leaving through a side wall: whichever of the x and z walls ahead comes first
+            auto wall_x = s.direction.x() == 0 ? real(inf)
+                    : (corner.x() + (i + (s.direction.x() > 0)) * cell_width - s.origin.x()) * s.inverse.x();
+            auto wall_z = s.direction.z() == 0 ? real(inf)
+                    : (corner.z() + (k + (s.direction.z() > 0)) * cell_depth - s.origin.z()) * s.inverse.z();
+            far_face = wall_x <= wall_z ? (s.direction.x() > 0 ? 1 : 0) : 4 + (s.direction.z() > 0 ? 1 : 0);
+        }
+        s.rec.set_hit(this, far, cell * 6 + far_face);
+        return true;
+    }
+};
+
+#endif //GRAPHICA_HEIGHTFIELD_H
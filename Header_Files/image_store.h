@@ -0,0 +1,101 @@
+//
+// Created by Aryan Singh on 6/18/24.
+//
+
+#ifndef GRAPHICA_IMAGE_STORE_H
+#define GRAPHICA_IMAGE_STORE_H
+
+#include "constants.h"
+#include "rtw_image.h"
+#include "mipmap.h"
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Process-wide registry of texture images. Each file is located and decoded once, however many
+// textures ask for it, and only its mip pyramid is kept: the decoder's buffers are released as soon
+// as the pyramid is built. Requests are remembered by the name they were made with as well as by
+// the resolved path, so repeated requests skip the directory search too.
+class image_store {
+public:
+    // The pyramid for image_filename, searched for like rtw_image does. A file that cannot be loaded
+    // gives an empty pyramid, and the error is reported once.
+    static shared_ptr<const mipmap> load(const char* image_filename) {
+        auto& store = instance();
+        std::lock_guard<std::mutex> lock(store.mutex);
+
+        auto requested = store.by_name.find(image_filename);
+        if (requested != store.by_name.end()) {
+            return requested->second;
+        }
+
+        auto path = rtw_image::resolve(image_filename);
+        shared_ptr<const mipmap> mips;
+        auto loaded = store.by_path.find(path);
+        if (!path.empty() && loaded != store.by_path.end()) {
+            mips = loaded->second;
+        } else {
+            mips = decode(path);
+            if (mips->empty()) {
+                std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
+            } else {
+                store.by_path[path] = mips;
+            }
+        }
+        store.by_name[image_filename] = mips;
+        return mips;
+    }
+
+    // One line per loaded image with its size, texel format and the memory of its pyramid.
+    static void report(std::ostream& out) {
+        auto& store = instance();
+        std::lock_guard<std::mutex> lock(store.mutex);
+
+        size_t total = 0;
+        for (const auto& [path, mips] : store.by_path) {
+            out << "Texture " << path << ": " << mips->width() << "x" << mips->height() << ", "
+                << (mips->storage() == mipmap::format::half ? "half float" : "8-bit") << ", "
+                << std::fixed << std::setprecision(2) << mips->memory() / (1024.0 * 1024.0) << " MiB\n";
+            total += mips->memory();
+        }
+        if (!store.by_path.empty()) {
+            out << "Texture memory: " << std::fixed << std::setprecision(2) << total / (1024.0 * 1024.0) << " MiB\n";
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, shared_ptr<const mipmap>> by_name;
+    std::map<std::string, shared_ptr<const mipmap>> by_path;
+
+    static image_store& instance() {
+        static image_store store;
+        return store;
+    }
+
+    // HDR files keep their range as half floats, read from rtw_image's float buffer; everything
+    // else keeps the file's 8-bit values
+    static shared_ptr<const mipmap> decode(const std::string& path) {
+        if (path.empty()) {
+            return make_shared<mipmap>();
+        }
+        if (stbi_is_hdr(path.c_str())) {
+            rtw_image image;
+            if (!image.load(path)) {
+                return make_shared<mipmap>();
+            }
+            return make_shared<mipmap>(image.width(), image.height(), mipmap::format::half, image.float_data());
+        }
+        int width = 0, height = 0, channels = 0;
+        unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, 3);
+        if (data == nullptr) {
+            return make_shared<mipmap>();
+        }
+        auto mips = make_shared<mipmap>(width, height, mipmap::format::gamma8, data);
+        stbi_image_free(data);
+        return mips;
+    }
+};
+
+#endif //GRAPHICA_IMAGE_STORE_H
@@ -7,32 +7,35 @@
 
 #include "constants.h"
 
-class interval {
+template <typename T>
+class interval_t {
 public:
-    double min, max;
+    using scalar = T;
 
-    interval(): min(+inf), max(-inf) {}
+    T min, max;
 
-    interval(double min, double max): min(min), max(max) {}
+    interval_t(): min(+inf), max(-inf) {}
 
-    interval(const interval& a, const interval& b) {
+    interval_t(T min, T max): min(min), max(max) {}
+
+    interval_t(const interval_t& a, const interval_t& b) {
         min = fmin(a.min, b.min);
         max = fmax(a.max, b.max);
     }
 
-    double size() const {
+    T size() const {
         return max - min;
     }
 
-    bool contains(double x) const {
+    bool contains(T x) const {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(T x) const {
         return min < x && x < max;
     }
 
-    double bound_to(double x) const {
+    T bound_to(T x) const {
         if (x < min) {
             return min;
         }
@@ -43,24 +46,30 @@ public:
         return x;
     }
 
-    [[nodiscard]] interval pad(double x) const {
-        return interval(min-x/2, max+x/2);
+    [[nodiscard]] interval_t pad(T x) const {
+        return interval_t(min-x/2, max+x/2);
     }
 
 
 
 
-    static const interval empty, universe;
+    static const interval_t empty, universe;
 };
 
-const interval interval::empty = interval();
-const interval interval::universe = interval(-inf, inf);
+template <typename T>
+const interval_t<T> interval_t<T>::empty = interval_t<T>();
+template <typename T>
+const interval_t<T> interval_t<T>::universe = interval_t<T>(-inf, inf);
+
+using interval = interval_t<real>;
 
-interval operator+(const interval& inter, double value) {
-    return interval(inter.min+value, inter.max+value);
+template <typename T>
+interval_t<T> operator+(const interval_t<T>& inter, typename interval_t<T>::scalar value) {
+    return interval_t<T>(inter.min+value, inter.max+value);
 }
 
-interval operator+(double value, const interval& inter) {
+template <typename T>
+interval_t<T> operator+(typename interval_t<T>::scalar value, const interval_t<T>& inter) {
     return inter+value;
 }
 
@@ -0,0 +1,419 @@
+//
+// Created by Aryan Singh on 6/24/24.
+//
+
+#ifndef GRAPHICA_LIGHT_TREE_H
+#define GRAPHICA_LIGHT_TREE_H
+
+#include "constants.h"
+#include "entity.h"
+#include "sampling.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// What a light sampler knows about an emitter, or a cluster of them, without looking inside: where
+// it is, how much it emits, and which way. The surface normals lie within angle theta_o of axis,
+// and each point emits up to theta_e past its normal (pi/2 for diffuse emitters). Two-sided
+// emitters also emit around -axis.
+struct light_bounds {
+    axis_aligned_bounding_box bounds = axis_aligned_bounding_box::empty;
+    vec3 axis = vec3(0, 0, 1);
+    double cos_theta_o = 1;
+    double cos_theta_e = 0;
+    double power = 0;
+    bool two_sided = false;
+
+    // Conservative estimate of how much of the emitted power reaches p (Conty Estevez and Kulla,
+    // "Importance Sampling of Many Lights with Adaptive Tree Splitting"): the power over the
+    // squared distance, times the cosine of the smallest angle any emitting direction in the
+    // bounds can make with the direction to p. Zero only if nothing in the bounds can light p.
+    [[nodiscard]] double importance(const point3& p) const {
+        auto center = 0.5 * (point3(bounds.x.min, bounds.y.min, bounds.z.min) + point3(bounds.x.max, bounds.y.max, bounds.z.max));
+        auto radius = 0.5 * (point3(bounds.x.max, bounds.y.max, bounds.z.max) - point3(bounds.x.min, bounds.y.min, bounds.z.min)).length();
+        auto to_point = p - center;
+        auto distance_squared = to_point.length_squared();
+        // points inside the bounds would otherwise get unbounded importance
+        auto clamped_squared = fmax(distance_squared, radius * radius);
+
+        auto cos_theta_w = distance_squared > 0 ? dot(axis, to_point) / sqrt(distance_squared) : 1.0;
+        if (two_sided) {
+            cos_theta_w = fabs(cos_theta_w);
+        }
+        auto sin_theta_w = sqrt(fmax(0.0, 1 - cos_theta_w * cos_theta_w));
+
+        // theta_x = max(0, theta_w - theta_o - theta_b), where the bounds subtend a cone of angle
+        // theta_b around the direction to their centre; worked in cosines and sines, as the
+        // differences of angles, to keep inverse trigonometry out of the tree walk
+        double cos_theta_x = 1;
+        if (distance_squared > radius * radius && cos_theta_w < cos_theta_o) {
+            auto sin_theta_b = radius / sqrt(distance_squared);
+            auto cos_theta_b = sqrt(fmax(0.0, 1 - sin_theta_b * sin_theta_b));
+            auto sin_theta_o = sqrt(fmax(0.0, 1 - cos_theta_o * cos_theta_o));
+            auto cos_wo = cos_theta_w * cos_theta_o + sin_theta_w * sin_theta_o;
+            auto sin_wo = sin_theta_w * cos_theta_o - cos_theta_w * sin_theta_o;
+            if (cos_wo < cos_theta_b) {
+                cos_theta_x = cos_wo * cos_theta_b + sin_wo * sin_theta_b;
+            }
+        }
+        if (cos_theta_x <= cos_theta_e) {
+            return 0;
+        }
+        return power * cos_theta_x / clamped_squared;
+    }
+
+    // bounds covering both a and b
+    static light_bounds merge(const light_bounds& a, const light_bounds& b) {
+        if (a.power <= 0) {
+            return b;
+        }
+        if (b.power <= 0) {
+            return a;
+        }
+        light_bounds merged;
+        merged.bounds = axis_aligned_bounding_box(a.bounds, b.bounds);
+        merged.power = a.power + b.power;
+        merged.cos_theta_e = fmin(a.cos_theta_e, b.cos_theta_e);
+        merged.two_sided = a.two_sided || b.two_sided;
+        merge_cones(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o, merged.axis, merged.cos_theta_o);
+        return merged;
+    }
+
+private:
+    // smallest cone containing cones a and b
+    static void merge_cones(const vec3& axis_a, double cos_a, const vec3& axis_b, double cos_b, vec3& axis, double& cos_o) {
+        axis = axis_a;
+        cos_o = -1; // the whole sphere
+        if (cos_a <= -1 || cos_b <= -1) {
+            return;
+        }
+        auto theta_a = acos(fmin(cos_a, 1.0));
+        auto theta_b = acos(fmin(cos_b, 1.0));
+        auto theta_d = acos(fmin(fmax(dot(axis_a, axis_b), -1.0), 1.0));
+        if (fmin(theta_d + theta_b, pi) <= theta_a) {
+            cos_o = cos_a;
+            return;
+        }
+        if (fmin(theta_d + theta_a, pi) <= theta_b) {
+            axis = axis_b;
+            cos_o = cos_b;
+            return;
+        }
+        auto theta_o = (theta_a + theta_d + theta_b) / 2;
+        auto normal = cross(axis_a, axis_b);
+        if (theta_o >= pi || normal.length_squared() == 0) {
+            return;
+        }
+        // turn axis_a towards axis_b until the cone just reaches both
+        auto k = unit_vector(normal);
+        auto theta_r = theta_o - theta_a;
+        axis = unit_vector(axis_a * cos(theta_r) + cross(k, axis_a) * sin(theta_r));
+        cos_o = cos(theta_o);
+    }
+};
+
+// Light sampler for scenes with many emitters: a binary tree over the emitters whose nodes hold the
+// light_bounds of everything below them. random() walks from the root, choosing each child with
+// probability proportional to its importance for the point being lit, so a light is picked in
+// O(log n) steps and nearby, bright, facing lights are picked most. pdf_value() repeats the walk
+// for the lights a direction meets, following each one's recorded path from the root.
+//
+// Like an entity_list of lights it is also an entity whose hit() finds the nearest emitter, so the
+// integrator can use either. The emitters must outlive the tree.
+//
+// Paths that start on the lights instead choose one by power alone (sample_by_power()), since
+// there is no point yet to judge importance from.
+class light_tree : public entity {
+public:
+    light_tree() = default;
+
+    // Emitters that cannot describe themselves as lights (emitter_bounds()) are left out.
+    explicit light_tree(const vector<const entity*>& emitters) {
+        vector<build_item> items;
+        for (auto e : emitters) {
+            light_bounds light;
+            if (e->emitter_bounds(light) && light.power > 0) {
+                items.push_back({uint32_t(lights.size()), light});
+                lights.push_back(e);
+            }
+        }
+        if (items.empty()) {
+            return;
+        }
+        vector<double> powers;
+        for (const auto& item : items) {
+            // lights that cannot be sampled over their surface are never chosen to start a path
+            powers.push_back(lights[item.light]->surface_area() > 0 ? item.bounds.power : 0.0);
+            emits_both_sides.push_back(item.bounds.two_sided);
+        }
+        by_power = piecewise_constant_1d(powers);
+        trails.assign(lights.size(), 0);
+        nodes.reserve(2 * items.size());
+        build(items, 0, items.size(), 0, 0);
+    }
+
+    [[nodiscard]] size_t size() const { return lights.size(); }
+    [[nodiscard]] bool empty() const { return lights.empty(); }
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return nodes.empty() ? axis_aligned_bounding_box::empty : nodes[0].light.bounds;
+    }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        bool hit_anything = false;
+        visit(r, ray_t, [&](uint32_t i) {
+            if (lights[i]->hit(r, ray_t, rec)) {
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        });
+        return hit_anything;
+    }
+
+    // Density of random(): for every light the direction meets, the probability of choosing it
+    // times its own solid angle density.
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        double sum = 0;
+        visit(ray(origin, direction), interval(0.001, inf), [&](uint32_t i) {
+            auto density = lights[i]->pdf_value(origin, direction);
+            if (density > 0) {
+                sum += probability(i, origin) * density;
+            }
+        });
+        return sum;
+    }
+
+    // A direction towards a light chosen by importance for origin; the zero vector if no light can
+    // reach origin.
+    vec3 random(const point3& origin) const override {
+        if (nodes.empty()) {
+            return vec3(0, 0, 0);
+        }
+        uint32_t index = 0;
+        while (!nodes[index].leaf) {
+            auto left = index + 1;
+            auto right = nodes[index].first;
+            auto weight_left = nodes[left].light.importance(origin);
+            auto weight_right = nodes[right].light.importance(origin);
+            if (weight_left + weight_right <= 0) {
+                return vec3(0, 0, 0);
+            }
+            index = random_double() * (weight_left + weight_right) < weight_left ? left : right;
+        }
+        return lights[nodes[index].first]->random(origin);
+    }
+
+    // A light chosen with probability proportional to its power, where a path that leaves the
+    // lights starts; nullptr if none can be sampled over its surface. two_sided tells whether it
+    // emits from both faces, index where it is in light().
+    const entity* sample_by_power(double r, double& probability, bool& two_sided, size_t& index) const {
+        if (by_power.integral() <= 0) {
+            return nullptr;
+        }
+        index = by_power.sample_discrete(r, probability);
+        two_sided = emits_both_sides[index];
+        return lights[index];
+    }
+
+    [[nodiscard]] const entity& light(size_t i) const { return *lights[i]; }
+
+    // Density per unit area with which sample_by_power(), then a uniform point on the chosen
+    // light's surface, produces p: summed over the lights the segment from `from` meets at p.
+    // two_sided is set for the light found there.
+    double origin_pdf(const point3& from, const point3& p, bool& two_sided) const {
+        if (by_power.integral() <= 0) {
+            return 0;
+        }
+        double sum = 0;
+        ray towards(from, p - from);
+        interval at_p(1 - 1e-4, 1 + 1e-4);
+        visit(towards, at_p, [&](uint32_t i) {
+            entity_record rec;
+            auto area = lights[i]->surface_area();
+            if (area > 0 && lights[i]->hit(towards, at_p, rec)) {
+                sum += by_power.density(i) / double(by_power.size()) / area;
+                two_sided = emits_both_sides[i];
+            }
+        });
+        return sum;
+    }
+
+    void flatten(vector<const entity*>& leaves) const override {
+        leaves.insert(leaves.end(), lights.begin(), lights.end());
+    }
+
+private:
+    // Interior nodes: the left child follows the node, first is the right child. Leaves: first is
+    // the light.
+    struct node {
+        light_bounds light;
+        uint32_t first = 0;
+        bool leaf = false;
+    };
+
+    struct build_item {
+        uint32_t light;
+        light_bounds bounds;
+
+        [[nodiscard]] double centroid(int axis) const {
+            const auto& i = bounds.bounds.axis_of_interval(axis);
+            return 0.5 * (i.min + i.max);
+        }
+    };
+
+    static const int bin_count = 12;
+    static const int max_depth = 64;
+
+    vector<const entity*> lights;
+    vector<uint64_t> trails; // per light, bit d set where its path from the root goes right at depth d
+    vector<node> nodes;
+    piecewise_constant_1d by_power; // over lights, in the order of lights
+    vector<bool> emits_both_sides;
+
+    // Calls found(light) for every light whose bounds r crosses within ray_t.
+    template<typename Found>
+    void visit(const ray& r, interval ray_t, Found&& found) const {
+        if (nodes.empty()) {
+            return;
+        }
+        uint32_t stack[max_depth + 1];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            auto index = stack[--stack_size];
+            const auto& n = nodes[index];
+            if (!n.light.bounds.hit(r, ray_t)) {
+                continue;
+            }
+            if (n.leaf) {
+                found(n.first);
+                continue;
+            }
+            stack[stack_size++] = n.first;
+            stack[stack_size++] = index + 1;
+        }
+    }
+
+    // Probability that random(origin) chooses light i.
+    [[nodiscard]] double probability(uint32_t i, const point3& origin) const {
+        double p = 1;
+        uint32_t index = 0;
+        for (int depth = 0; !nodes[index].leaf; depth++) {
+            auto left = index + 1;
+            auto right = nodes[index].first;
+            auto weight_left = nodes[left].light.importance(origin);
+            auto weight_right = nodes[right].light.importance(origin);
+            if (weight_left + weight_right <= 0) {
+                return 0;
+            }
+            bool go_right = (trails[i] >> depth) & 1;
+            p *= (go_right ? weight_right : weight_left) / (weight_left + weight_right);
+            index = go_right ? right : left;
+        }
+        return p;
+    }
+
+    // Solid angle term of the surface area orientation heuristic: how spread out the emitted
+    // directions of a cluster are.
+    static double orientation_measure(const light_bounds& b) {
+        auto theta_o = acos(fmin(fmax(b.cos_theta_o, -1.0), 1.0));
+        auto theta_e = acos(fmin(fmax(b.cos_theta_e, -1.0), 1.0));
+        auto theta_w = fmin(theta_o + theta_e, pi);
+        auto sin_theta_o = sin(theta_o);
+        return 2 * pi * (1 - cos(theta_o)) +
+               pi / 2 * (2 * theta_w * sin_theta_o - cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_theta_o + cos(theta_o));
+    }
+
+    static double surface_area(const axis_aligned_bounding_box& box) {
+        auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // expected cost of a cluster: its power spread over its area and its directions
+    static double cluster_cost(const light_bounds& b) {
+        return b.power * orientation_measure(b) * fmax(surface_area(b.bounds), 1e-12);
+    }
+
+    uint32_t build(vector<build_item>& items, size_t start, size_t end, uint64_t trail, int depth) {
+        auto index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        light_bounds all;
+        auto centroids = axis_aligned_bounding_box::empty;
+        for (size_t i = start; i < end; i++) {
+            all = light_bounds::merge(all, items[i].bounds);
+            point3 c(items[i].centroid(0), items[i].centroid(1), items[i].centroid(2));
+            centroids = axis_aligned_bounding_box(centroids, axis_aligned_bounding_box(c, c));
+        }
+        nodes[index].light = all;
+
+        if (end - start == 1) {
+            nodes[index].leaf = true;
+            nodes[index].first = items[start].light;
+            trails[items[start].light] = trail;
+            return index;
+        }
+
+        // Binned split minimising the summed cost of the two halves. Deep trees fall back to
+        // median splits so every path fits in a trail.
+        int axis = centroids.longest_axis();
+        int best_bin = 0;
+        double best_cost = inf;
+        for (int a = 0; a < 3 && depth < max_depth - 32; a++) {
+            const auto& extent = centroids.axis_of_interval(a);
+            if (extent.size() <= 0) {
+                continue;
+            }
+            light_bounds bins[bin_count];
+            for (size_t i = start; i < end; i++) {
+                auto b = bin_of(items[i], a, extent);
+                bins[b] = light_bounds::merge(bins[b], items[i].bounds);
+            }
+            // long thin clusters are penalised when split across their short side
+            auto regulariser = centroids.axis_of_interval(centroids.longest_axis()).size() / extent.size();
+            for (int split = 1; split < bin_count; split++) {
+                light_bounds below, above;
+                for (int b = 0; b < split; b++) {
+                    below = light_bounds::merge(below, bins[b]);
+                }
+                for (int b = split; b < bin_count; b++) {
+                    above = light_bounds::merge(above, bins[b]);
+                }
+                if (below.power <= 0 || above.power <= 0) {
+                    continue;
+                }
+                auto cost = regulariser * (cluster_cost(below) + cluster_cost(above));
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    axis = a;
+                    best_bin = split;
+                }
+            }
+        }
+
+        size_t mid = start;
+        if (best_cost < inf) {
+            const auto& extent = centroids.axis_of_interval(axis);
+            mid = size_t(std::partition(items.begin() + start, items.begin() + end,
+                                        [&](const build_item& item) { return bin_of(item, axis, extent) < best_bin; })
+                         - items.begin());
+        }
+        if (mid == start || mid == end) {
+            mid = start + (end - start) / 2;
+            std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+                             [axis](const build_item& a, const build_item& b) { return a.centroid(axis) < b.centroid(axis); });
+        }
+
+        build(items, start, mid, trail, depth + 1);
+        auto right = build(items, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+        nodes[index].first = right;
+        return index;
+    }
+
+    static int bin_of(const build_item& item, int axis, const interval& extent) {
+        auto b = int(bin_count * (item.centroid(axis) - extent.min) / extent.size());
+        return b < 0 ? 0 : (b >= bin_count ? bin_count - 1 : b);
+    }
+};
+
+#endif //GRAPHICA_LIGHT_TREE_H
@@ -4,10 +4,15 @@
 
 #ifndef GRAPHICA_MATERIAL_H
 #define GRAPHICA_MATERIAL_H
+#include <cstdint>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "constants.h"
 #include "texture.h"
+#include "sampling.h"
+#include "microfacet.h"
 
 class entity_record;
 
@@ -23,7 +28,47 @@ class material {
             return color(0,0,0);
         }
 
+        // Radiance typical of the whole emitting surface, which weighs lights against each other
+        // when they are sampled. Zero for materials that do not emit.
+        [[nodiscard]] virtual color emitted_radiance() const {
+            return color(0,0,0);
+        }
+
         virtual double scattering_pdf(const ray& r_in, const entity_record& rec, const ray& scattered) const { return 0; }
+
+        // BSDF for scattering r_in into scattered, times the cosine at the scattered side: what a
+        // light sample in that direction is weighted by. scatter()'s change is this over
+        // scattering_pdf(). Zero for perfectly specular materials, which light samples cannot hit.
+        virtual color scattering_bsdf(const ray& r_in, const entity_record& rec, const ray& scattered) const {
+            return color(0,0,0);
+        }
+};
+
+// Materials registered with a scene. Primitives that hold many materials keep a 32-bit index into
+// the table, and hit records carry the raw pointer it hands out, so shading never touches a
+// shared_ptr reference count that every render thread would be contending on.
+class material_table {
+public:
+    // Returns the index of m, registering it on first use.
+    uint32_t add(const shared_ptr<material>& m) {
+        auto found = index_of.find(m.get());
+        if (found != index_of.end()) {
+            return found->second;
+        }
+        auto index = uint32_t(owned.size());
+        owned.push_back(m);
+        raw.push_back(m.get());
+        index_of.emplace(m.get(), index);
+        return index;
+    }
+
+    const material* operator[](uint32_t index) const { return raw[index]; }
+    size_t size() const { return raw.size(); }
+
+private:
+    vector<shared_ptr<material>> owned;
+    vector<const material*> raw;
+    unordered_map<const material*, uint32_t> index_of;
 };
 
 class lambertian: public material {
@@ -34,21 +79,23 @@ class lambertian: public material {
         bool scatter(const ray& incidence, const entity_record& record, color& change, ray& scattered)
         const override {
 //            clog << "Reached scatter \n";
-            auto scattered_direction = record.normal + normalize_vec_in_unit_sphere();
-//            clog << "Reached scatter 2 \n";
-            if (scattered_direction.is_near_zero()) {
-                scattered_direction = record.normal;
-            }
+            auto scattered_direction = random_cosine_direction(record.normal);
 //            clog << "Reached scatter 3 \n";
             scattered = ray(record.p, scattered_direction, incidence.time());
 //            clog << "Reached scatter 4 \n";
-            change = textures->value(record.u, record.v, record.p);
+            change = textures->filtered_value(record.u, record.v, record.p,
+                                              record.footprint * record.du_dl, record.footprint * record.dv_dl);
 //            clog << "Exited scatter \n";
             return true;
         }
         double scattering_pdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
-            auto cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
-            return cos_theta < 0 ? 0 : cos_theta/pi;
+            return cosine_hemisphere_pdf(dot(rec.normal, unit_vector(scattered.direction())));
+        }
+
+        color scattering_bsdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
+            auto albedo = textures->filtered_value(rec.u, rec.v, rec.p,
+                                                   rec.footprint * rec.du_dl, rec.footprint * rec.dv_dl);
+            return albedo * cosine_hemisphere_pdf(dot(rec.normal, unit_vector(scattered.direction())));
         }
 
 
@@ -63,7 +110,7 @@ public:
     bool scatter(const ray& incidence, const entity_record& record, color& change, ray& scattered)
     const override {
         vec3 reflected_ray = metal_reflect(incidence.direction(), record.normal);
-        reflected_ray = unit_vector(reflected_ray) + (fuzz * normalize_vec_in_unit_sphere());
+        reflected_ray = unit_vector(reflected_ray) + (fuzz * random_unit_vector());
         scattered = ray(record.p, reflected_ray, incidence.time());
         change = albedo;
         return (dot(scattered.direction(), record.normal) > 0);
@@ -114,6 +161,173 @@ private:
     }
 };
 
+// Shading frame of a hit: wo is the direction back along the incident ray, wi the scattered one,
+// both in the onb of the (face-forward) normal, so wo.z > 0.
+inline void local_directions(const ray& r_in, const entity_record& rec, const ray& scattered, vec3& wo, vec3& wi) {
+    onb uvw;
+    uvw.build(rec.normal);
+    wo = uvw.to_local(-unit_vector(r_in.direction()));
+    wi = uvw.to_local(unit_vector(scattered.direction()));
+}
+
+// Rough metal: GGX microfacets with Schlick's Fresnel from the colour at normal incidence.
+// Microfacet normals are drawn from the distribution visible from the incident direction, so
+// almost every sample leaves above the surface, and the few that do not are the only paths lost.
+class rough_conductor : public material {
+public:
+    rough_conductor(const color& reflectance, double roughness) : reflectance(reflectance), distribution(roughness) {}
+
+    bool scatter(const ray& incidence, const entity_record& record, color& change, ray& scattered)
+    const override {
+        onb uvw;
+        uvw.build(record.normal);
+        auto wo = uvw.to_local(-unit_vector(incidence.direction()));
+        if (wo.z() <= 0) {
+            return false;
+        }
+        auto r1 = random_double();
+        auto r2 = random_double();
+        auto m = distribution.sample_visible_normal(wo, r1, r2);
+        auto wi = metal_reflect(-wo, m);
+        if (wi.z() <= 0) {
+            return false;
+        }
+        // bsdf * cos / pdf of the visible normal sample
+        change = fresnel_schlick(reflectance, dot(wo, m)) * (distribution.G2(wo, wi) / distribution.G1(wo));
+        scattered = ray(record.p, uvw.local(wi), incidence.time());
+        return true;
+    }
+
+    double scattering_pdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
+        vec3 wo, wi;
+        local_directions(r_in, rec, scattered, wo, wi);
+        if (wo.z() <= 0 || wi.z() <= 0) {
+            return 0;
+        }
+        auto m = unit_vector(wo + wi);
+        return distribution.visible_normal_pdf(wo, m) / (4 * dot(wo, m));
+    }
+
+    color scattering_bsdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
+        vec3 wo, wi;
+        local_directions(r_in, rec, scattered, wo, wi);
+        if (wo.z() <= 0 || wi.z() <= 0) {
+            return color(0,0,0);
+        }
+        auto m = unit_vector(wo + wi);
+        return fresnel_schlick(reflectance, dot(wo, m))
+               * (distribution.D(m) * distribution.G2(wo, wi) / (4 * wo.z()));
+    }
+
+private:
+    color reflectance;
+    ggx distribution;
+};
+
+// Rough glass (Walter et al., "Microfacet Models for Refraction through Rough Surfaces"). A
+// visible microfacet normal is sampled, then reflection or refraction through it is chosen with
+// the exact dielectric Fresnel term as probability, so the weight of either is G2 / G1. Like
+// dielectric, radiance is not rescaled by the squared index ratio on crossing.
+class rough_dielectric : public material {
+public:
+    rough_dielectric(double refractive_index, double roughness)
+            : refractive_index(refractive_index), distribution(roughness) {}
+
+    bool scatter(const ray& incidence, const entity_record& record, color& change, ray& scattered)
+    const override {
+        onb uvw;
+        uvw.build(record.normal);
+        auto wo = uvw.to_local(-unit_vector(incidence.direction()));
+        if (wo.z() <= 0) {
+            return false;
+        }
+        auto eta = record.front_face ? refractive_index : 1.0 / refractive_index;
+        auto r1 = random_double();
+        auto r2 = random_double();
+        auto m = distribution.sample_visible_normal(wo, r1, r2);
+        auto cos_o = dot(wo, m);
+        auto reflectance = fresnel_dielectric(cos_o, eta);
+
+        vec3 wi;
+        if (random_double() < reflectance) {
+            wi = metal_reflect(-wo, m);
+            if (wi.z() <= 0) {
+                return false;
+            }
+        } else {
+            wi = refract(-wo, m, 1 / eta);
+            if (wi.z() >= 0) {
+                return false;
+            }
+        }
+        auto g = distribution.G2(wo, wi) / distribution.G1(wo);
+        change = color(g, g, g);
+        scattered = ray(record.p, uvw.local(wi), incidence.time());
+        return true;
+    }
+
+    double scattering_pdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
+        vec3 wo, wi, m;
+        double eta, denominator;
+        if (!half_vector(r_in, rec, scattered, wo, wi, m, eta, denominator)) {
+            return 0;
+        }
+        auto reflectance = fresnel_dielectric(dot(wo, m), eta);
+        auto pdf_m = distribution.visible_normal_pdf(wo, m);
+        if (wi.z() > 0) {
+            return reflectance * pdf_m / (4 * dot(wo, m));
+        }
+        return (1 - reflectance) * pdf_m * eta * eta * fabs(dot(wi, m)) / (denominator * denominator);
+    }
+
+    color scattering_bsdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
+        vec3 wo, wi, m;
+        double eta, denominator;
+        if (!half_vector(r_in, rec, scattered, wo, wi, m, eta, denominator)) {
+            return color(0,0,0);
+        }
+        auto reflectance = fresnel_dielectric(dot(wo, m), eta);
+        auto dg = distribution.D(m) * distribution.G2(wo, wi);
+        double value;
+        if (wi.z() > 0) {
+            value = reflectance * dg / (4 * wo.z());
+        } else {
+            value = fabs(dot(wi, m)) * dot(wo, m) / wo.z() * eta * eta * (1 - reflectance) * dg
+                    / (denominator * denominator);
+        }
+        return color(value, value, value);
+    }
+
+private:
+    double refractive_index;
+    ggx distribution;
+
+    // Microfacet normal that takes wo into wi, facing wo: the half vector for reflection, and
+    // -(wo + eta wi) for refraction. denominator is wo.m + eta wi.m, used by the refraction terms.
+    bool half_vector(const ray& r_in, const entity_record& rec, const ray& scattered,
+                     vec3& wo, vec3& wi, vec3& m, double& eta, double& denominator) const {
+        local_directions(r_in, rec, scattered, wo, wi);
+        if (wo.z() <= 0 || wi.z() == 0) {
+            return false;
+        }
+        eta = rec.front_face ? refractive_index : 1.0 / refractive_index;
+        if (wi.z() > 0) {
+            m = unit_vector(wo + wi);
+        } else {
+            m = unit_vector(wo + eta * wi);
+            if (m.z() < 0) {
+                m = -m;
+            }
+            denominator = dot(wo, m) + eta * dot(wi, m);
+            // the pair must sit on opposite sides of the microfacet
+            if (dot(wi, m) >= 0 || dot(wo, m) <= 0) {
+                return false;
+            }
+        }
+        return dot(wo, m) > 0;
+    }
+};
+
 class diffuse_light : public material {
 public:
     explicit diffuse_light(shared_ptr<texture> textures): textures(textures) {}
@@ -122,6 +336,11 @@ public:
     color emit(double u, double v, const point3& p) const override {
         return textures->value(u, v, p);
     }
+
+    // the texture at the centre of the surface's uv square
+    [[nodiscard]] color emitted_radiance() const override {
+        return textures->value(0.5, 0.5, point3(0,0,0));
+    }
 private:
     shared_ptr<texture> textures;
 };
@@ -133,11 +352,19 @@ public:
     isotropic(shared_ptr<texture> textures) : textures(textures) {}
 
     bool scatter(const ray& incidence, const entity_record& record, color& change, ray& scattered) const override {
-        scattered = ray(record.p, normalize_vec_in_unit_sphere(), incidence.time());
+        scattered = ray(record.p, random_unit_vector(), incidence.time());
         change = textures->value(record.u, record.v, record.p);
         return true;
     }
 
+    double scattering_pdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
+        return uniform_sphere_pdf();
+    }
+
+    color scattering_bsdf(const ray& r_in, const entity_record& rec, const ray& scattered) const override {
+        return textures->value(rec.u, rec.v, rec.p) * uniform_sphere_pdf();
+    }
+
 private:
     shared_ptr<texture> textures;
 };
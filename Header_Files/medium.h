@@ -0,0 +1,118 @@
+//
+// Created by Aryan Singh on 6/22/24.
+//
+
+#ifndef GRAPHICA_MEDIUM_H
+#define GRAPHICA_MEDIUM_H
+
+#include "constants.h"
+#include "texture.h"
+#include "material.h"
+#include <cassert>
+
+// Participating medium filling the space between surfaces. A path knows which medium it travels
+// through (see medium_stack) and asks it, for each segment up to the next surface, whether the
+// light scatters inside it first.
+class medium {
+public:
+    virtual ~medium() = default;
+
+    // Samples where along r, before t_max, the next real collision happens. Returns false when
+    // the ray reaches t_max without one.
+    virtual bool sample_collision(const ray& r, real t_max, real& t) const = 0;
+
+    // Extinction coefficient at p, per unit of distance.
+    [[nodiscard]] virtual double density(const point3& p) const = 0;
+
+    // Fraction of light that travels along r from its origin to r.at(t) without a collision.
+    [[nodiscard]] virtual double transmittance(const ray& r, real t) const = 0;
+
+    // Material that scatters the light at a collision.
+    [[nodiscard]] virtual const material* phase_function() const = 0;
+};
+
+// Constant density medium with an isotropic phase function.
+class homogeneous_medium : public medium {
+public:
+    homogeneous_medium(double density, shared_ptr<texture> textures)
+    : sigma(density), neg_inv_density(-1.0/density), phase(make_shared<isotropic>(textures)) {}
+
+    homogeneous_medium(double density, const color& albedo)
+    : sigma(density), neg_inv_density(-1.0/density), phase(make_shared<isotropic>(albedo)) {}
+
+    bool sample_collision(const ray& r, real t_max, real& t) const override {
+        // exponential free flight, in distance and then in units of the ray parameter
+        auto distance = neg_inv_density * log(1 - random_double());
+        auto hit_t = distance / r.direction().length();
+        if (!(hit_t < t_max)) {
+            return false;
+        }
+        t = real(hit_t);
+        return true;
+    }
+
+    [[nodiscard]] double density(const point3& p) const override {
+        return sigma;
+    }
+
+    [[nodiscard]] double transmittance(const ray& r, real t) const override {
+        return exp(-sigma * t * r.direction().length());
+    }
+
+    [[nodiscard]] const material* phase_function() const override {
+        return phase.get();
+    }
+
+private:
+    double sigma;
+    double neg_inv_density;
+    shared_ptr<material> phase;
+};
+
+// Media a path is inside, innermost last. Surfaces that bound a medium report it as their
+// interior (entity_record::interior); a path crossing such a surface enters the medium when it
+// arrives from the front and leaves it otherwise, so media can nest, e.g. smoke inside glass
+// inside haze, without any surface having to know what lies outside it.
+class medium_stack {
+public:
+    [[nodiscard]] const medium* current() const {
+        return count > 0 ? entries[count - 1] : nullptr;
+    }
+
+    // deeper nesting than max_depth is a scene error: the dropped entry would make a later
+    // leave() remove the wrong one
+    void enter(const medium* m) {
+        assert(count < max_depth && "media nested deeper than medium_stack::max_depth");
+        if (count < max_depth) {
+            entries[count++] = m;
+        }
+    }
+
+    // removes the innermost entry of m; leaving a medium the path never entered changes nothing
+    void leave(const medium* m) {
+        for (int i = count - 1; i >= 0; i--) {
+            if (entries[i] == m) {
+                for (int j = i; j < count - 1; j++) {
+                    entries[j] = entries[j + 1];
+                }
+                count--;
+                return;
+            }
+        }
+    }
+
+    void cross(const medium* m, bool entering) {
+        if (entering) {
+            enter(m);
+        } else {
+            leave(m);
+        }
+    }
+
+private:
+    static const int max_depth = 8;
+    const medium* entries[max_depth];
+    int count = 0;
+};
+
+#endif //GRAPHICA_MEDIUM_H
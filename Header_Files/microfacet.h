@@ -0,0 +1,93 @@
+//
+// Created by Aryan Singh on 6/21/24.
+//
+
+#ifndef GRAPHICA_MICROFACET_H
+#define GRAPHICA_MICROFACET_H
+
+#include "constants.h"
+
+// Isotropic GGX (Trowbridge-Reitz) microfacet distribution with the Smith shadowing terms. All
+// directions are in the local shading frame, z along the normal and on the side the light
+// arrives from.
+class ggx {
+public:
+    // perceptual roughness in [0, 1]; alpha = roughness^2, kept off zero so the lobe stays finite
+    explicit ggx(double roughness) : alpha(fmax(roughness * roughness, 1e-3)) {}
+
+    // density of microfacet normals m per unit projected area
+    [[nodiscard]] double D(const vec3& m) const {
+        if (m.z() <= 0) {
+            return 0;
+        }
+        auto a2 = alpha * alpha;
+        auto t = (m.x() * m.x() + m.y() * m.y()) / a2 + m.z() * m.z();
+        return 1 / (pi * a2 * t * t);
+    }
+
+    // Smith auxiliary function
+    [[nodiscard]] double lambda(const vec3& w) const {
+        auto z2 = w.z() * w.z();
+        if (z2 == 0) {
+            return inf;
+        }
+        auto tan2 = (w.x() * w.x() + w.y() * w.y()) / z2;
+        return (sqrt(1 + alpha * alpha * tan2) - 1) / 2;
+    }
+
+    // masking of w, and height-correlated masking-shadowing of the pair
+    [[nodiscard]] double G1(const vec3& w) const { return 1 / (1 + lambda(w)); }
+    [[nodiscard]] double G2(const vec3& wo, const vec3& wi) const { return 1 / (1 + lambda(wo) + lambda(wi)); }
+
+    // Microfacet normal distributed as the normals visible from wo (wo.z > 0), D_wo(m) =
+    // G1(wo) max(0, wo.m) D(m) / wo.z. Heitz, "Sampling the GGX Distribution of Visible Normals"
+    // (JCGT 2018): stretch to the unit-roughness configuration, sample the projected hemisphere,
+    // unstretch.
+    [[nodiscard]] vec3 sample_visible_normal(const vec3& wo, double r1, double r2) const {
+        auto vh = unit_vector(vec3(alpha * wo.x(), alpha * wo.y(), wo.z()));
+        auto length_squared = vh.x() * vh.x() + vh.y() * vh.y();
+        auto t1_axis = length_squared > 0 ? vec3(-vh.y(), vh.x(), 0) / sqrt(length_squared) : vec3(1, 0, 0);
+        auto t2_axis = cross(vh, t1_axis);
+
+        auto r = sqrt(r1);
+        auto phi = 2 * pi * r2;
+        auto t1 = r * cos(phi);
+        auto t2 = r * sin(phi);
+        auto s = 0.5 * (1 + vh.z());
+        t2 = (1 - s) * sqrt(fmax(0.0, 1 - t1 * t1)) + s * t2;
+
+        auto nh = t1 * t1_axis + t2 * t2_axis + sqrt(fmax(0.0, 1 - t1 * t1 - t2 * t2)) * vh;
+        return unit_vector(vec3(alpha * nh.x(), alpha * nh.y(), fmax(1e-6, nh.z())));
+    }
+
+    // density of sample_visible_normal()
+    [[nodiscard]] double visible_normal_pdf(const vec3& wo, const vec3& m) const {
+        auto cosine = dot(wo, m);
+        return cosine <= 0 ? 0 : G1(wo) * cosine * D(m) / wo.z();
+    }
+
+private:
+    double alpha;
+};
+
+// Unpolarised Fresnel reflectance of a dielectric interface. cos_i is measured on the incident
+// side and eta is the ratio of the far side's index to the incident side's.
+inline double fresnel_dielectric(double cos_i, double eta) {
+    auto sin2_t = (1 - cos_i * cos_i) / (eta * eta);
+    if (sin2_t >= 1) {
+        return 1; // total internal reflection
+    }
+    auto cos_t = sqrt(1 - sin2_t);
+    auto parallel = (eta * cos_i - cos_t) / (eta * cos_i + cos_t);
+    auto perpendicular = (cos_i - eta * cos_t) / (cos_i + eta * cos_t);
+    return (parallel * parallel + perpendicular * perpendicular) / 2;
+}
+
+// Schlick's approximation for a conductor with normal-incidence reflectance f0.
+inline color fresnel_schlick(const color& f0, double cosine) {
+    auto m = fmin(fmax(1 - cosine, 0.0), 1.0);
+    auto m5 = m * m * m * m * m;
+    return f0 + m5 * (color(1, 1, 1) - f0);
+}
+
+#endif //GRAPHICA_MICROFACET_H
@@ -0,0 +1,234 @@
+//
+// Created by Aryan Singh on 6/18/24.
+//
+
+#ifndef GRAPHICA_MIPMAP_H
+#define GRAPHICA_MIPMAP_H
+
+#include "constants.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Mip pyramid of an image, built once at load time. Level 0 is the image itself and every further
+// level halves both sides with a 2x2 box filter, down to a single texel. Lookups take the size of
+// the area to average in uv units and blend the two levels whose texels bracket that size
+// (trilinear filtering), so a texture seen from far away returns the average colour of the region
+// a ray covers instead of one arbitrary texel of the full image.
+//
+// Texels are kept in the narrowest format that holds the source: the gamma-encoded bytes of an 8-bit
+// file, decoded through a 256-entry table, or half floats for HDR files. Filtering always happens
+// on linear values.
+class mipmap {
+public:
+    enum class format { gamma8, half };
+
+    mipmap() {}
+
+    // width * height RGB texels, rows top to bottom: bytes as stored in the file for gamma8, linear
+    // floats for half.
+    mipmap(int width, int height, format texel_format, const void* rgb) : texel_format(texel_format) {
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+        level base = make_level(width, height);
+        auto count = size_t(width) * height * 3;
+        if (texel_format == format::gamma8) {
+            std::memcpy(base.bytes.data(), rgb, count);
+        } else {
+            auto values = static_cast<const float*>(rgb);
+            for (size_t i = 0; i < count; i++) {
+                base.halves[i] = float_to_half(values[i]);
+            }
+        }
+        levels.push_back(std::move(base));
+
+        while (levels.back().width > 1 || levels.back().height > 1) {
+            levels.push_back(downsample(levels.back()));
+        }
+    }
+
+    [[nodiscard]] bool empty() const { return levels.empty(); }
+    [[nodiscard]] int width() const { return empty() ? 0 : levels[0].width; }
+    [[nodiscard]] int height() const { return empty() ? 0 : levels[0].height; }
+    [[nodiscard]] format storage() const { return texel_format; }
+
+    // bytes held by all levels
+    [[nodiscard]] size_t memory() const {
+        size_t total = 0;
+        for (const auto& lv : levels) {
+            total += lv.bytes.size() + lv.halves.size() * sizeof(uint16_t);
+        }
+        return total;
+    }
+
+    // Colour around (u, v), where u runs left to right and v top to bottom over [0, 1]. du and dv
+    // are the extent of the footprint along each axis; zero gives a bilinear lookup of level 0.
+    [[nodiscard]] color lookup(double u, double v, double du, double dv) const {
+        const auto& base = levels[0];
+        // level where the longer side of the footprint covers one texel
+        auto texels = std::max(du * base.width, dv * base.height);
+        if (texels <= 1) {
+            return bilinear(base, u, v);
+        }
+        auto lod = std::min(log2(texels), double(levels.size() - 1));
+        int fine = int(lod);
+        if (fine + 1 >= int(levels.size())) {
+            return bilinear(levels[fine], u, v);
+        }
+        auto blend = lod - fine;
+        return (1 - blend) * bilinear(levels[fine], u, v) + blend * bilinear(levels[fine + 1], u, v);
+    }
+
+private:
+    // RGB rows in bytes (gamma8) or halves (half); the other vector stays empty
+    struct level {
+        int width, height;
+        std::vector<uint8_t> bytes;
+        std::vector<uint16_t> halves;
+    };
+
+    std::vector<level> levels;
+    format texel_format = format::gamma8;
+
+    // 8-bit files are decoded with the same 2.2 gamma stb_image applies when asked for floats
+    static constexpr double gamma = 2.2;
+
+    static const std::array<float, 256>& gamma_table() {
+        static const std::array<float, 256> table = [] {
+            std::array<float, 256> t{};
+            for (int i = 0; i < 256; i++) {
+                t[i] = float(pow(i / 255.0, gamma));
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    static uint8_t encode_gamma(double linear) {
+        auto encoded = pow(std::clamp(linear, 0.0, 1.0), 1 / gamma);
+        return uint8_t(encoded * 255 + 0.5);
+    }
+
+    static uint16_t float_to_half(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+        int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+        uint32_t mantissa = bits & 0x7fffff;
+
+        // out of range values saturate to the largest finite half, so a zero filter weight on them
+        // still gives zero; nan becomes zero
+        if (((bits >> 23) & 0xff) == 0xff) {
+            return mantissa ? 0 : uint16_t(sign | 0x7bff);
+        }
+        if (exponent >= 31) {
+            return uint16_t(sign | 0x7bff);
+        }
+        if (exponent <= 0) {
+            if (exponent < -10) {
+                return sign; // too small: zero
+            }
+            // subnormal half
+            mantissa |= 0x800000;
+            int shift = 14 - exponent;
+            uint32_t rounded = (mantissa + (1u << (shift - 1))) >> shift;
+            return uint16_t(sign | rounded);
+        }
+        // round to nearest; a carry out of the mantissa correctly bumps the exponent
+        uint32_t rounded = ((uint32_t(exponent) << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1);
+        return uint16_t(sign | std::min<uint32_t>(rounded, 0x7bff));
+    }
+
+    static float half_to_float(uint16_t half) {
+        uint32_t sign = uint32_t(half & 0x8000) << 16;
+        uint32_t exponent = (half >> 10) & 0x1f;
+        uint32_t mantissa = half & 0x3ff;
+        uint32_t bits;
+        if (exponent == 0) {
+            if (mantissa == 0) {
+                bits = sign;
+            } else {
+                // subnormal: renormalise
+                int shift = 0;
+                while (!(mantissa & 0x400)) {
+                    mantissa <<= 1;
+                    shift++;
+                }
+                bits = sign | (uint32_t(127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        } else if (exponent == 31) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else {
+            bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        }
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    level make_level(int width, int height) const {
+        level lv{width, height, {}, {}};
+        auto count = size_t(width) * height * 3;
+        if (texel_format == format::gamma8) {
+            lv.bytes.resize(count);
+        } else {
+            lv.halves.resize(count);
+        }
+        return lv;
+    }
+
+    level downsample(const level& fine) const {
+        level coarse = make_level(std::max(1, fine.width / 2), std::max(1, fine.height / 2));
+        for (int y = 0; y < coarse.height; y++) {
+            int y0 = std::min(2 * y, fine.height - 1);
+            int y1 = std::min(2 * y + 1, fine.height - 1);
+            for (int x = 0; x < coarse.width; x++) {
+                int x0 = std::min(2 * x, fine.width - 1);
+                int x1 = std::min(2 * x + 1, fine.width - 1);
+                auto average = 0.25 * (texel(fine, x0, y0) + texel(fine, x1, y0)
+                                       + texel(fine, x0, y1) + texel(fine, x1, y1));
+                auto offset = (size_t(y) * coarse.width + x) * 3;
+                for (int c = 0; c < 3; c++) {
+                    if (texel_format == format::gamma8) {
+                        coarse.bytes[offset + c] = encode_gamma(average[c]);
+                    } else {
+                        coarse.halves[offset + c] = float_to_half(float(average[c]));
+                    }
+                }
+            }
+        }
+        return coarse;
+    }
+
+    color texel(const level& lv, int x, int y) const {
+        x = std::clamp(x, 0, lv.width - 1);
+        y = std::clamp(y, 0, lv.height - 1);
+        auto offset = (size_t(y) * lv.width + x) * 3;
+        if (texel_format == format::gamma8) {
+            const auto& table = gamma_table();
+            const uint8_t* t = &lv.bytes[offset];
+            return color(table[t[0]], table[t[1]], table[t[2]]);
+        }
+        const uint16_t* t = &lv.halves[offset];
+        return color(half_to_float(t[0]), half_to_float(t[1]), half_to_float(t[2]));
+    }
+
+    // texel centres sit at half-integer coordinates; edges are clamped
+    color bilinear(const level& lv, double u, double v) const {
+        auto x = u * lv.width - 0.5;
+        auto y = v * lv.height - 0.5;
+        auto x0 = floor(x);
+        auto y0 = floor(y);
+        real fx = x - x0;
+        real fy = y - y0;
+        int i = int(x0);
+        int j = int(y0);
+        return (1 - fy) * ((1 - fx) * texel(lv, i, j) + fx * texel(lv, i + 1, j))
+               + fy * ((1 - fx) * texel(lv, i, j + 1) + fx * texel(lv, i + 1, j + 1));
+    }
+};
+
+#endif //GRAPHICA_MIPMAP_H
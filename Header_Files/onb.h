@@ -28,6 +28,11 @@ public:
         return vec.x()*u() + vec.y()*v() + vec.z()*w();
     }
 
+    // inverse of local(): coordinates of a world space vector in this basis
+    vec3 to_local(const vec3& vec) const {
+        return vec3(dot(vec, u()), dot(vec, v()), dot(vec, w()));
+    }
+
     void build(const vec3& w_basis) {
         vec3 unit = unit_vector(w_basis);
         axis[2] = unit;
@@ -6,50 +6,50 @@
 #define GRAPHICA_PERLIN_H
 
 #include "constants.h"
+#include "simd.h"
+#include <algorithm>
+#include <cstdint>
 
 class perlin {
 public:
     perlin() {
-        randvec = new vec3[num_of_points];
         for (int i = 0; i < num_of_points; i++) {
-            randvec[i] = unit_vector(vec3::random_vector());
+            auto g = unit_vector(vec3::random_vector());
+            gradient_x[i] = g.x();
+            gradient_y[i] = g.y();
+            gradient_z[i] = g.z();
         }
-        perm_x = generate_permutation();
-        perm_y = generate_permutation();
-        perm_z = generate_permutation();
-    }
-
-    ~perlin() {
-        delete[] randvec;
-        delete[] perm_x;
-        delete[] perm_y;
-        delete[] perm_z;
+        generate_permutation(perm_x);
+        generate_permutation(perm_y);
+        generate_permutation(perm_z);
     }
 
     double noise(const point3& p) const {
+        double x = p.x(), y = p.y(), z = p.z();
 
-        auto u = p.x() - floor(p.x());
-        auto v = p.y() - floor(p.y());
-        auto w = p.z() - floor(p.z());
+        auto u = x - floor(x);
+        auto v = y - floor(y);
+        auto w = z - floor(z);
 
-        auto i = int(floor(p.x()));
-        auto j = int(floor(p.y()));
-        auto k = int(floor(p.z()));
-        vec3 c[2][2][2];
+        auto i = int(floor(x));
+        auto j = int(floor(y));
+        auto k = int(floor(z));
 
+        auto new_u = u*u*(3-2*u);
+        auto new_v = v*v*(3-2*v);
+        auto new_w = w*w*(3-2*w);
+        auto sum = 0.0;
         for (int di = 0; di < 2; di++) {
             for (int dj = 0; dj < 2; dj++) {
                 for (int dk = 0; dk < 2; dk++) {
-                    c[di][dj][dk] = randvec[
-                            perm_x[(di+i) & 255]
-                            ^ perm_y[(dj+j) & 255]
-                            ^ perm_z[(dk+k) & 255]
-                            ]; // can also do mod 256 but bitwise is faster
+                    int g = perm_x[(di+i) & 255] ^ perm_y[(dj+j) & 255] ^ perm_z[(dk+k) & 255];
+                    auto dot = gradient_x[g] * (u-di) + gradient_y[g] * (v-dj) + gradient_z[g] * (w-dk);
+                    sum += dot * (di ? new_u : 1-new_u) * (dj ? new_v : 1-new_v) * (dk ? new_w : 1-new_w);
                 }
             }
         }
 
-        return trilinear_interpolate(c, u, v, w); // for smoothness
+        return sum; // smoothed trilinear blend of the eight corner gradients
     }
 
     double turbulence(const point3& p, int iterations) const {
@@ -64,52 +64,118 @@ public:
         return fabs(sum);
     }
 
+    // values[n] = noise(points[n]) for n < count. Points are taken four at a time: the lattice
+    // lookups are gathered per lane and the eight corner blends run on double4, giving the same
+    // results as the single point version.
+    void noise(const point3* points, double* values, size_t count) const {
+        for (size_t first = 0; first < count; first += 4) {
+            double x[4], y[4], z[4];
+            int lanes = load_lanes(points + first, count - first, x, y, z);
+            double result[4];
+            noise4(x, y, z).store(result);
+            std::copy_n(result, lanes, values + first);
+        }
+    }
+
+    // values[n] = turbulence(points[n], iterations) for n < count, four points at a time.
+    void turbulence(const point3* points, double* values, size_t count, int iterations) const {
+        for (size_t first = 0; first < count; first += 4) {
+            double x[4], y[4], z[4];
+            int lanes = load_lanes(points + first, count - first, x, y, z);
+            double4 sum(0.0);
+            double weight = 1.0;
+            for (int i = 0; i < iterations; i++) {
+                sum = sum + double4(weight) * noise4(x, y, z);
+                weight *= 0.5;
+                // doubling is exact, so this matches scaling the point itself
+                for (int l = 0; l < 4; l++) {
+                    x[l] *= 2;
+                    y[l] *= 2;
+                    z[l] *= 2;
+                }
+            }
+            double result[4];
+            abs(sum).store(result);
+            std::copy_n(result, lanes, values + first);
+        }
+    }
+
 private:
     static const int num_of_points = 256;
-//    double* randfloat;
-    vec3* randvec;
-    int* perm_x;
-    int* perm_y;
-    int* perm_z;
-
-    static int* generate_permutation() {
-        auto p = new int[num_of_points];
+    // 8-bit permutations and gradients split by component, so each component can be gathered for
+    // four lattice points at once. Gradients are doubles in either precision since noise is.
+    double gradient_x[num_of_points], gradient_y[num_of_points], gradient_z[num_of_points];
+    uint8_t perm_x[num_of_points];
+    uint8_t perm_y[num_of_points];
+    uint8_t perm_z[num_of_points];
+
+    static void generate_permutation(uint8_t* p) {
         for (int i = 0; i < num_of_points; i++) {
-            p[i] = i;
+            p[i] = uint8_t(i);
         }
         permute(p, num_of_points);
-        return p;
     }
 
-    static void permute(int* p, int n) {
-//        clog << "Reached here \n";
+    static void permute(uint8_t* p, int n) {
         for (int i = n-1; i > 0; i--) {
             int target = random_int(0, i);
-            int tmp = p[i];
+            uint8_t tmp = p[i];
             p[i] = p[target];
             p[target] = tmp;
         }
-//        clog << "Reached here 2 \n";
     }
 
-    static double trilinear_interpolate(vec3 c[2][2][2], double u, double v, double w) {
+    // Copies up to four points into lane arrays, repeating the last point in unused lanes.
+    static int load_lanes(const point3* points, size_t remaining, double* x, double* y, double* z) {
+        int lanes = remaining < 4 ? int(remaining) : 4;
+        for (int l = 0; l < 4; l++) {
+            const point3& p = points[l < lanes ? l : lanes - 1];
+            x[l] = p.x();
+            y[l] = p.y();
+            z[l] = p.z();
+        }
+        return lanes;
+    }
 
-        auto new_u = u*u*(3-2*u);
-        auto new_v = v*v*(3-2*v);
-        auto new_w = w*w*(3-2*w);
-        auto sum = 0.0;
-        for (int i = 0; i < 2; i++) {
-            for (int j = 0; j < 2; j++) {
-                for (int k = 0; k < 2; k++) {
-                    vec3 weight_vector(u-i, v-j, w-k);
-                    sum += dot(c[i][j][k], weight_vector) *
-                            (i * new_u + (1-i) * (1-new_u)) *
-                            (j * new_v + (1-j) * (1-new_v)) *
-                            (k * new_w + (1-k) * (1-new_w));
-                }
+    double4 noise4(const double* x, const double* y, const double* z) const {
+        double u[4], v[4], w[4];
+        // per lane, the permutation entries of the two lattice planes on each axis
+        int hx[2][4], hy[2][4], hz[2][4];
+        for (int l = 0; l < 4; l++) {
+            auto fx = floor(x[l]), fy = floor(y[l]), fz = floor(z[l]);
+            u[l] = x[l] - fx;
+            v[l] = y[l] - fy;
+            w[l] = z[l] - fz;
+            int i = int(fx), j = int(fy), k = int(fz);
+            for (int d = 0; d < 2; d++) {
+                hx[d][l] = perm_x[(i+d) & 255];
+                hy[d][l] = perm_y[(j+d) & 255];
+                hz[d][l] = perm_z[(k+d) & 255];
             }
         }
 
+        auto u4 = double4::load(u), v4 = double4::load(v), w4 = double4::load(w);
+        double4 one(1.0), two(2.0), three(3.0);
+        auto new_u = u4*u4*(three - two*u4);
+        auto new_v = v4*v4*(three - two*v4);
+        auto new_w = w4*w4*(three - two*w4);
+
+        double4 sum(0.0);
+        for (int di = 0; di < 2; di++) {
+            for (int dj = 0; dj < 2; dj++) {
+                for (int dk = 0; dk < 2; dk++) {
+                    int32_t g[4];
+                    for (int l = 0; l < 4; l++) {
+                        g[l] = hx[di][l] ^ hy[dj][l] ^ hz[dk][l];
+                    }
+                    auto dot = double4::gather(gradient_x, g) * (u4 - double4(di))
+                               + double4::gather(gradient_y, g) * (v4 - double4(dj))
+                               + double4::gather(gradient_z, g) * (w4 - double4(dk));
+                    sum = sum + dot * (di ? new_u : one - new_u) * (dj ? new_v : one - new_v)
+                                * (dk ? new_w : one - new_w);
+                }
+            }
+        }
         return sum;
     }
 };
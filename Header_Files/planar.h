@@ -0,0 +1,240 @@
+//
+// Created by Aryan Singh on 6/17/24.
+//
+
+#ifndef GRAPHICA_PLANAR_H
+#define GRAPHICA_PLANAR_H
+
+#include "constants.h"
+#include "entity.h"
+#include "onb.h"
+#include "sampling.h"
+#include "material.h"
+#include "light_tree.h"
+
+// Flat shapes spanned by a corner q and two edge vectors u and v. A plane hit is expressed as
+// p = q + alpha*u + beta*v, and the shape is decided by which (alpha, beta) count as inside. That
+// test is a compile-time policy, so every shape shares the same intersection code and the test
+// inlines into it. A policy provides:
+//   contains(alpha, beta)      whether the plane point is on the shape
+//   lower                      smallest alpha / beta the shape reaches (the largest is 1)
+//   area_fraction()            area of the shape over |u x v|
+//   sample(r1, r2, alpha, beta) uniform point on the shape from two uniform numbers
+//   uv(alpha, beta, u, v)      texture coordinates of a hit
+//   uv_scale()                 change of u and v per unit of alpha and beta
+
+struct quad_interior {
+    static constexpr real lower = 0;
+    static double area_fraction() { return 1; }
+
+    static bool contains(real alpha, real beta) {
+        return alpha >= 0 && alpha <= 1 && beta >= 0 && beta <= 1;
+    }
+
+    static void sample(double r1, double r2, real& alpha, real& beta) {
+        alpha = r1;
+        beta = r2;
+    }
+
+    static real uv_scale() { return 1; }
+
+    static void uv(real alpha, real beta, real& u, real& v) {
+        u = alpha;
+        v = beta;
+    }
+};
+
+// Triangle q, q + u, q + v.
+struct triangle_interior {
+    static constexpr real lower = 0;
+    static double area_fraction() { return 0.5; }
+
+    static bool contains(real alpha, real beta) {
+        return alpha >= 0 && beta >= 0 && alpha + beta <= 1;
+    }
+
+    static void sample(double r1, double r2, real& alpha, real& beta) {
+        auto s = sqrt(r1);
+        alpha = 1 - s;
+        beta = r2 * s;
+    }
+
+    static real uv_scale() { return 1; }
+
+    static void uv(real alpha, real beta, real& u, real& v) {
+        u = alpha;
+        v = beta;
+    }
+};
+
+// Ellipse centred on q with conjugate semi-axes u and v.
+struct ellipse_interior {
+    static constexpr real lower = -1;
+    static double area_fraction() { return pi; }
+
+    static bool contains(real alpha, real beta) {
+        return alpha * alpha + beta * beta <= 1;
+    }
+
+    static void sample(double r1, double r2, real& alpha, real& beta) {
+        auto d = sample_concentric_disk(r1, r2);
+        alpha = d.x();
+        beta = d.y();
+    }
+
+    static real uv_scale() { return 0.5; }
+
+    static void uv(real alpha, real beta, real& u, real& v) {
+        u = (alpha + 1) / 2;
+        v = (beta + 1) / 2;
+    }
+};
+
+template <typename Interior>
+class planar : public entity {
+public:
+
+    // q is the corner (the centre for an ellipse), u and v are the edge vectors leaving it
+    planar(const point3& q, const vec3& u, const vec3& v, shared_ptr<material> materials) :
+    q(q), u(u), v(v), materials(materials) {
+        auto n = cross(u, v);
+        normal = unit_vector(n);
+        D = dot(normal, q); // for plane equation (Ax+By+Cz = D)
+        area = n.length() * Interior::area_fraction();
+
+        // alpha = w . ((p - q) x v) = (p - q) . (v x w), and likewise for beta, so both are one dot
+        // product against a precomputed axis
+        auto w = n / dot(n, n);
+        alpha_axis = cross(v, w);
+        beta_axis = cross(w, u);
+        alpha_rate = alpha_axis.length() * Interior::uv_scale();
+        beta_rate = beta_axis.length() * Interior::uv_scale();
+
+        auto lo = Interior::lower;
+        bbox = axis_aligned_bounding_box(axis_aligned_bounding_box(q + lo*u + lo*v, q + u + v),
+                                         axis_aligned_bounding_box(q + u + lo*v, q + lo*u + v));
+    }
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return bbox;
+    }
+
+    bool hit(const ray& incidence, interval ray, entity_record& record) const override {
+        auto denominator = dot(normal, incidence.direction());
+
+        if (fabs(denominator) < 1e-8) {
+            return false; // parallel ray to plane
+        }
+
+        // t = (D - n*P) / n * d  remember: ray: R(t) = P + td
+        auto t = (D - dot(normal, incidence.origin())) / denominator;
+        if (!ray.contains(t)) {
+            return false; // no intersection
+        }
+
+        // relative to q first: p . axis - q . axis would cancel away the precision of hits far from
+        // the origin
+        auto planar = incidence.at(t) - q;
+        real alpha = dot(planar, alpha_axis);
+        real beta = dot(planar, beta_axis);
+
+        if (!Interior::contains(alpha, beta)) {
+            return false;
+        }
+        record.set_hit(this, t, 0, alpha, beta);
+        return true;
+    }
+
+    void surface_interaction(const ray& incidence, entity_record& record) const override {
+        record.p = incidence.at(record.t);
+        Interior::uv(record.b1, record.b2, record.u, record.v);
+        // alpha_axis and beta_axis are the in-plane gradients of alpha and beta
+        record.du_dl = alpha_rate;
+        record.dv_dl = beta_rate;
+        record.materials = materials.get();
+        record.set_face_normal(incidence, normal);
+    }
+
+    // Solid angle density of random() as seen from origin, for sampling the shape as an area light.
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        entity_record rec;
+        if (!this->hit(ray(origin, direction), interval(0.001, inf), rec)) {
+            return 0;
+        }
+
+        auto distance_squared = rec.t * rec.t * direction.length_squared();
+        auto cosine = fabs(dot(direction, normal) / direction.length());
+
+        return distance_squared / (cosine * area);
+    }
+
+    vec3 random(const point3& origin) const override {
+        real alpha, beta;
+        Interior::sample(random_double(), random_double(), alpha, beta);
+        return q + alpha*u + beta*v - origin;
+    }
+
+    // emission does not depend on the side a surface is seen from, so both faces emit
+    bool emitter_bounds(light_bounds& light) const override {
+        if (!materials) {
+            return false;
+        }
+        auto radiance = luminance(materials->emitted_radiance());
+        if (radiance <= 0) {
+            return false;
+        }
+        light.bounds = bbox;
+        light.axis = normal;
+        light.cos_theta_o = 1;
+        light.cos_theta_e = 0;
+        light.power = 2 * pi * radiance * area;
+        light.two_sided = true;
+        return true;
+    }
+
+    [[nodiscard]] double surface_area() const override {
+        return area;
+    }
+
+    bool sample_surface(entity_record& rec) const override {
+        real alpha, beta;
+        Interior::sample(random_double(), random_double(), alpha, beta);
+        rec.p = q + alpha*u + beta*v;
+        rec.normal = normal;
+        rec.front_face = true;
+        Interior::uv(alpha, beta, rec.u, rec.v);
+        rec.materials = materials.get();
+        return true;
+    }
+
+private:
+    point3 q;
+    vec3 u,v;
+    shared_ptr<material> materials;
+    axis_aligned_bounding_box bbox;
+    real D;
+    vec3 normal;
+    vec3 alpha_axis, beta_axis;
+    real alpha_rate, beta_rate;
+    double area;
+};
+
+using quadrilateral = planar<quad_interior>;
+using triangle = planar<triangle_interior>;
+using ellipse = planar<ellipse_interior>;
+
+// Circle of the given radius around center, facing along normal.
+class disk : public ellipse {
+public:
+    disk(const point3& center, const vec3& normal, double radius, shared_ptr<material> materials)
+            : ellipse(center, radius * basis(normal).u(), radius * basis(normal).v(), materials) {}
+
+private:
+    static onb basis(const vec3& normal) {
+        onb uvw;
+        uvw.build(normal);
+        return uvw;
+    }
+};
+
+#endif //GRAPHICA_PLANAR_H
@@ -6,26 +6,77 @@
 #define GRAPHICA_RAY_H
 
 #include "vec3.h"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 
-class ray {
+template <typename T>
+class ray_t {
 public:
-    ray() {}
+    ray_t() {}
 
-    ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction), tm(0) {}
-    ray(const point3& origin, const vec3& direction, double time) : orig(origin), dir(direction), tm(time) {}
+    ray_t(const vec3_t<T>& origin, const vec3_t<T>& direction) : orig(origin), dir(direction), tm(0) {}
+    ray_t(const vec3_t<T>& origin, const vec3_t<T>& direction, T time) : orig(origin), dir(direction), tm(time) {}
 
-    point3 origin() const  { return orig; }
-    vec3 direction() const { return dir; }
-    double time() const { return tm; }
+    vec3_t<T> origin() const  { return orig; }
+    vec3_t<T> direction() const { return dir; }
+    T time() const { return tm; }
 
-    point3 at(double t) const {
+    vec3_t<T> at(T t) const {
         return orig + t*dir;
     }
 
+    // The ray stands for a cone of directions (Akenine-Moller et al., "Texture Level of Detail
+    // Strategies for Real-Time Ray Tracing"): cone_width() across at the origin, growing by
+    // cone_spread() per unit of distance travelled. Zero for rays that carry no footprint.
+    T cone_width() const { return width; }
+    T cone_spread() const { return spread; }
+
+    void set_cone(T cone_width, T cone_spread) {
+        width = cone_width;
+        spread = cone_spread;
+    }
+
 private:
-    point3 orig;
-    vec3 dir;
-    double tm;
+    vec3_t<T> orig;
+    vec3_t<T> dir;
+    T tm;
+    T width = 0;
+    T spread = 0;
 };
 
+using ray = ray_t<real>;
+
+// Origin for a ray leaving the surface point p, pushed off the surface along the geometric normal
+// towards the side the new direction points into (Wachter and Binder, "A Fast and Robust Method for
+// Avoiding Self-Intersection", Ray Tracing Gems). The push is a fixed number of ulps of each
+// coordinate, so it tracks the rounding error of p at any distance from the origin, and a small
+// absolute step near zero where ulps vanish. This is what keeps single precision from
+// re-hitting the surface it just left.
+template <typename T>
+inline vec3_t<T> offset_ray_origin(const vec3_t<T>& p, const vec3_t<T>& normal, const vec3_t<T>& direction) {
+    using bits = std::conditional_t<sizeof(T) == 4, int32_t, int64_t>;
+    const T origin = T(1) / 32;
+    const T float_scale = std::numeric_limits<T>::epsilon() * 128;
+    const T int_scale = 256;
+
+    auto n = dot(normal, direction) < 0 ? -normal : normal;
+    vec3_t<T> offset_p;
+    for (int a = 0; a < 3; a++) {
+        if (fabs(p[a]) < origin) {
+            offset_p[a] = p[a] + float_scale * n[a];
+            continue;
+        }
+        bits offset = bits(int_scale * n[a]);
+        T value = p[a];
+        bits value_bits;
+        std::memcpy(&value_bits, &value, sizeof(T));
+        value_bits += (value < 0) ? -offset : offset;
+        std::memcpy(&value, &value_bits, sizeof(T));
+        offset_p[a] = value;
+    }
+    return offset_p;
+}
+
 #endif //GRAPHICA_RAY_H
@@ -16,6 +16,8 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
 
 class rtw_image {
 public:
@@ -29,23 +31,32 @@ public:
         // parent, on so on, for six levels up. If the image was not loaded successfully,
         // width() and height() will return 0.
 
-        auto filename = std::string(image_filename);
-        auto imagedir = getenv("RTW_IMAGES");
-
-        // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-        if (load(filename)) return;
-        if (load("images/" + filename)) return;
-        if (load("../images/" + filename)) return;
-        if (load("../../images/" + filename)) return;
-        if (load("../../../images/" + filename)) return;
-        if (load("../../../../images/" + filename)) return;
-        if (load("../../../../../images/" + filename)) return;
-        if (load("../../../../../../images/" + filename)) return;
+        auto path = resolve(image_filename);
+        if (!path.empty() && load(path)) return;
 
         std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
     }
 
+    // Path of the first readable image among the locations listed above, or an empty string.
+    // Only the header of each candidate is read.
+    static std::string resolve(const char* image_filename) {
+        auto filename = std::string(image_filename);
+        auto imagedir = getenv("RTW_IMAGES");
+        int x, y, n;
+
+        std::vector<std::string> candidates;
+        if (imagedir) candidates.push_back(std::string(imagedir) + "/" + image_filename);
+        candidates.push_back(filename);
+        std::string prefix = "images/";
+        for (int up = 0; up < 7; up++, prefix = "../" + prefix) {
+            candidates.push_back(prefix + filename);
+        }
+        for (const auto& candidate : candidates) {
+            if (stbi_info(candidate.c_str(), &x, &y, &n)) return candidate;
+        }
+        return "";
+    }
+
     ~rtw_image() {
         delete[] bdata;
         STBI_FREE(fdata);
@@ -70,6 +81,12 @@ public:
     int width()  const { return (fdata == nullptr) ? 0 : image_width; }
     int height() const { return (fdata == nullptr) ? 0 : image_height; }
 
+    const float* float_data() const {
+        // Return the linear floating point pixel data described in load(), or nullptr if there is
+        // no image data. Unlike the bytes, HDR files keep their full range here.
+        return fdata;
+    }
+
     const unsigned char* pixel_data(int x, int y) const {
         // Return the address of the three RGB bytes of the pixel at x,y. If there is no image
         // data, returns magenta.
@@ -0,0 +1,184 @@
+//
+// Created by Aryan Singh on 6/20/24.
+//
+
+#ifndef GRAPHICA_SAMPLING_H
+#define GRAPHICA_SAMPLING_H
+
+#include "constants.h"
+#include "onb.h"
+#include <algorithm>
+#include <vector>
+
+// Closed-form warps from the unit square to the shapes the renderer samples. Each one takes
+// exactly two uniform numbers in [0, 1) and no loop, so a sample always consumes the same random
+// dimensions and stratified or low-discrepancy inputs keep their structure after the warp.
+// Directions are in a local frame with z as the axis; onb::local() takes them to world space.
+
+// Point on the unit disk in the xy plane. Shirley and Chiu's concentric map keeps neighbouring
+// squares of the input neighbouring on the disk, unlike the polar sqrt(r) map.
+inline vec3 sample_concentric_disk(double r1, double r2) {
+    auto a = 2 * r1 - 1;
+    auto b = 2 * r2 - 1;
+    if (a == 0 && b == 0) {
+        return vec3(0, 0, 0);
+    }
+    double radius, theta;
+    if (fabs(a) > fabs(b)) {
+        radius = a;
+        theta = (pi / 4) * (b / a);
+    } else {
+        radius = b;
+        theta = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(radius * cos(theta), radius * sin(theta), 0);
+}
+
+// Unit vector, uniform over the sphere.
+inline vec3 sample_uniform_sphere(double r1, double r2) {
+    auto z = 1 - 2 * r1;
+    auto r = sqrt(fmax(0.0, 1 - z * z));
+    auto phi = 2 * pi * r2;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+inline double uniform_sphere_pdf() {
+    return 1 / (4 * pi);
+}
+
+// Unit vector in the z >= 0 hemisphere with density cos(theta) / pi (Malley's method: a disk
+// point lifted onto the hemisphere).
+inline vec3 sample_cosine_hemisphere(double r1, double r2) {
+    auto d = sample_concentric_disk(r1, r2);
+    auto z = sqrt(fmax(0.0, 1 - d.x() * d.x() - d.y() * d.y()));
+    return vec3(d.x(), d.y(), z);
+}
+
+inline double cosine_hemisphere_pdf(double cos_theta) {
+    return cos_theta < 0 ? 0 : cos_theta / pi;
+}
+
+// Unit vector uniform over the cone of directions within acos(cos_theta_max) of +z, e.g. the
+// directions that see a sphere.
+inline vec3 sample_spherical_cap(double r1, double r2, double cos_theta_max) {
+    auto z = 1 + r1 * (cos_theta_max - 1);
+    auto r = sqrt(fmax(0.0, 1 - z * z));
+    auto phi = 2 * pi * r2;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+inline double spherical_cap_pdf(double cos_theta_max) {
+    return 1 / (2 * pi * (1 - cos_theta_max));
+}
+
+// Random unit vector, for callers with no sample stream of their own.
+inline vec3 random_unit_vector() {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    return sample_uniform_sphere(r1, r2);
+}
+
+// Random direction around normal with density cos(theta) / pi.
+inline vec3 random_cosine_direction(const vec3& normal) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    onb uvw;
+    uvw.build(normal);
+    return uvw.local(sample_cosine_hemisphere(r1, r2));
+}
+
+// Piecewise-constant density over [0, 1) with one step per weight, sampled by inverting its
+// cumulative distribution. All-zero weights give the uniform density.
+class piecewise_constant_1d {
+public:
+    piecewise_constant_1d() = default;
+
+    explicit piecewise_constant_1d(std::vector<double> weights) : function(std::move(weights)) {
+        auto n = function.size();
+        cdf.assign(n + 1, 0.0);
+        for (size_t i = 0; i < n; i++) {
+            cdf[i + 1] = cdf[i] + fabs(function[i]) / double(n);
+        }
+        total = cdf[n];
+        for (size_t i = 1; i <= n; i++) {
+            cdf[i] = total > 0 ? cdf[i] / total : double(i) / double(n);
+        }
+    }
+
+    [[nodiscard]] size_t size() const { return function.size(); }
+
+    // integral of the weights over [0, 1]
+    [[nodiscard]] double integral() const { return total; }
+
+    // Point x in [0, 1) with density pdf, and the step it falls in.
+    double sample(double r, double& pdf, size_t& step) const {
+        step = find_step(r);
+        auto width = cdf[step + 1] - cdf[step];
+        auto within = width > 0 ? (r - cdf[step]) / width : 0.0;
+        pdf = density(step);
+        return fmin((double(step) + within) / double(size()), 1 - 1e-12);
+    }
+
+    // Step chosen with probability proportional to its weight.
+    size_t sample_discrete(double r, double& probability) const {
+        auto step = find_step(r);
+        probability = cdf[step + 1] - cdf[step];
+        return step;
+    }
+
+    // density of sample() at any point of the given step
+    [[nodiscard]] double density(size_t step) const {
+        return total > 0 ? fabs(function[step]) / total : 1.0;
+    }
+
+private:
+    std::vector<double> function;
+    std::vector<double> cdf;
+    double total = 0;
+
+    [[nodiscard]] size_t find_step(double r) const {
+        // last entry of cdf not above r, skipping zero-width steps
+        auto it = std::upper_bound(cdf.begin(), cdf.end(), r);
+        auto step = size_t(std::max<ptrdiff_t>(0, (it - cdf.begin()) - 1));
+        return std::min(step, size() - 1);
+    }
+};
+
+// Piecewise-constant density over [0, 1)^2 on a width x height grid of weights, rows first:
+// a row (v) is chosen from the marginal, then a column (u) within it.
+class piecewise_constant_2d {
+public:
+    piecewise_constant_2d() = default;
+
+    piecewise_constant_2d(const std::vector<double>& weights, int width, int height) {
+        rows.reserve(height);
+        std::vector<double> marginal_weights(height);
+        for (int y = 0; y < height; y++) {
+            rows.emplace_back(std::vector<double>(weights.begin() + size_t(y) * width,
+                                                  weights.begin() + size_t(y + 1) * width));
+            marginal_weights[y] = rows.back().integral();
+        }
+        marginal = piecewise_constant_1d(marginal_weights);
+    }
+
+    // (u, v) with density pdf over the unit square
+    void sample(double r1, double r2, double& u, double& v, double& pdf) const {
+        double pdf_v, pdf_u;
+        size_t row, column;
+        v = marginal.sample(r2, pdf_v, row);
+        u = rows[row].sample(r1, pdf_u, column);
+        pdf = pdf_v * pdf_u;
+    }
+
+    [[nodiscard]] double pdf(double u, double v) const {
+        auto row = std::min(size_t(v * double(rows.size())), rows.size() - 1);
+        auto column = std::min(size_t(u * double(rows[row].size())), rows[row].size() - 1);
+        return marginal.density(row) * rows[row].density(column);
+    }
+
+private:
+    std::vector<piecewise_constant_1d> rows;
+    piecewise_constant_1d marginal;
+};
+
+#endif //GRAPHICA_SAMPLING_H
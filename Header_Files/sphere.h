@@ -7,6 +7,9 @@
 #include "entity.h"
 #include "vec3.h"
 #include "onb.h"
+#include "sampling.h"
+#include "material.h"
+#include "light_tree.h"
 class sphere: public entity {
 public:
     sphere(const point3& _center, double _radius, shared_ptr<material> materials): center(_center),
@@ -50,14 +53,18 @@ public:
             }
         }
 
-        // setting entity-record values
-        rec.t = root;
+        rec.set_hit(this, root);
+        return true;
+    }
+
+    void surface_interaction(const ray& r, entity_record& rec) const override {
+        point3 curr_center = is_moving ? new_center(r.time()) : center;
         rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p-center) / radius;
+        vec3 outward_normal = (rec.p-curr_center) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv_coord(outward_normal, rec.u, rec.v);
-        rec.materials = materials;
-        return true;
+        get_sphere_uv_rate(outward_normal, radius, rec.du_dl, rec.dv_dl);
+        rec.materials = materials.get();
     }
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
@@ -68,9 +75,7 @@ public:
             return 0;
 
         auto cos_theta_max = sqrt(1 - radius*radius/(center - origin).length_squared());
-        auto solid_angle = 2*pi*(1-cos_theta_max);
-
-        return  1 / solid_angle;
+        return spherical_cap_pdf(cos_theta_max);
     }
 
     vec3 random(const point3& origin) const override {
@@ -78,11 +83,47 @@ public:
         auto distance_squared = direction.length_squared();
         onb uvw;
         uvw.build(direction);
-        return uvw.local(random_to_sphere(radius, distance_squared));
+        auto r1 = random_double();
+        auto r2 = random_double();
+        return uvw.local(sample_spherical_cap(r1, r2, sqrt(1 - radius*radius/distance_squared)));
+    }
+
+    // emits outwards in every direction; moving spheres cannot be sampled as lights
+    bool emitter_bounds(light_bounds& light) const override {
+        if (is_moving || !materials) {
+            return false;
+        }
+        auto radiance = luminance(materials->emitted_radiance());
+        if (radiance <= 0) {
+            return false;
+        }
+        light.bounds = bbox;
+        light.cos_theta_o = -1;
+        light.cos_theta_e = 0;
+        light.power = pi * radiance * 4 * pi * radius * radius;
+        light.two_sided = false;
+        return true;
+    }
+
+    [[nodiscard]] double surface_area() const override {
+        return is_moving ? 0 : 4 * pi * radius * radius;
+    }
+
+    bool sample_surface(entity_record& rec) const override {
+        if (is_moving) {
+            return false;
+        }
+        auto outward_normal = random_unit_vector();
+        rec.p = center + radius * outward_normal;
+        rec.normal = outward_normal;
+        rec.front_face = true;
+        get_sphere_uv_coord(outward_normal, rec.u, rec.v);
+        rec.materials = materials.get();
+        return true;
     }
 private:
     point3 center;
-    double radius;
+    real radius;
     shared_ptr<material> materials;
     vec3 center_vector;
     bool is_moving = false;
@@ -92,7 +133,9 @@ private:
         return center + time * center_vector;
     }
 
-    static void get_sphere_uv_coord(const point3& p, double &u, double &v) {
+public:
+    // Also used by sphere_set, whose spheres have the same parametrisation.
+    static void get_sphere_uv_coord(const point3& p, real &u, real &v) {
         // p is point on unit sphere centered on origin
         // u is phi (cut through y-axis angle)
         // v is theta (sweep across y-axis angle)
@@ -105,16 +148,12 @@ private:
         v = theta/pi;
     }
 
-    static vec3 random_to_sphere(double radius, double distance_squared) {
-        auto r1 = random_double();
-        auto r2 = random_double();
-        auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
-
-        auto phi = 2*pi*r1;
-        auto x = cos(phi)*sqrt(1-z*z);
-        auto y = sin(phi)*sqrt(1-z*z);
-
-        return vec3(x, y, z);
+    // u and v per unit of arc length at p: a parallel of the sphere is 2 pi r sin(theta) long, a
+    // meridian pi r; the poles are clamped so the rate stays finite
+    static void get_sphere_uv_rate(const point3& p, real radius, real &du_dl, real &dv_dl) {
+        auto sin_theta = sqrt(fmax(1 - p.y() * p.y(), 1e-4));
+        du_dl = 1 / (2 * pi * radius * sin_theta);
+        dv_dl = 1 / (pi * radius);
     }
 };
 #endif //GRAPHICA_SPHERE_H
@@ -0,0 +1,230 @@
+//
+// Created by Aryan Singh on 6/14/24.
+//
+
+#ifndef GRAPHICA_SPHERE_SET_H
+#define GRAPHICA_SPHERE_SET_H
+
+#include "constants.h"
+#include "entity.h"
+#include "material.h"
+#include "simd.h"
+#include "sphere.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+// Large collections of static spheres (particle clouds, the sphere cluster in final_scene). Centers
+// and radii live in contiguous structure-of-arrays storage and each sphere only carries a 32-bit
+// index into a shared material table, instead of being a separate entity with its own material
+// pointer, bbox and vtable. The set builds its own BVH whose leaves are blocks of four spheres, so
+// a leaf is a single packet test. The packets are double4 in the float build as well.
+class sphere_set : public entity {
+public:
+    static const int lanes = 4;
+
+    // material_ids[i] is the index returned by materials->add() for the material of sphere i. The
+    // table is shared, not copied: one table can serve every sphere set in a scene.
+    sphere_set(const std::vector<point3>& centers, const std::vector<double>& radii,
+               const std::vector<uint32_t>& material_ids, shared_ptr<const material_table> materials)
+            : materials(std::move(materials)) {
+        // a sphere of no size has no normal to shade with
+        for (auto r : radii) {
+            if (!(r > 0)) {
+                throw std::invalid_argument("sphere_set: radii must be positive");
+            }
+        }
+        size_t n = centers.size();
+        std::vector<uint32_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        nodes.reserve(n > 0 ? 2 * (n / lanes + 1) : 1);
+        build(centers, radii, order, 0, n);
+
+        // write the spheres out in leaf order, each leaf padded to a full block
+        for (auto& node : nodes) {
+            if (node.count == 0) {
+                continue;
+            }
+            uint32_t first = node.first;
+            node.first = uint32_t(cx.size() / lanes);
+            for (int lane = 0; lane < lanes; lane++) {
+                if (lane < node.count) {
+                    uint32_t i = order[first + lane];
+                    cx.push_back(centers[i].x());
+                    cy.push_back(centers[i].y());
+                    cz.push_back(centers[i].z());
+                    radius.push_back(radii[i]);
+                    material_index.push_back(material_ids[i]);
+                } else {
+                    // NaN centers make every comparison in the packet test false
+                    cx.push_back(std::numeric_limits<double>::quiet_NaN());
+                    cy.push_back(0);
+                    cz.push_back(0);
+                    radius.push_back(0);
+                    material_index.push_back(0);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return nodes.empty() ? axis_aligned_bounding_box::empty : nodes[0].bbox;
+    }
+
+    size_t size() const { return cx.size(); }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const point3& origin = r.origin();
+        const vec3& direction = r.direction();
+        const vec3 inverse(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+
+        uint32_t stack[64];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        bool hit_anything = false;
+        size_t closest_slot = 0;
+
+        while (stack_size > 0) {
+            const auto& node = nodes[stack[--stack_size]];
+            if (!node.bbox.hit(r, ray_t)) {
+                continue;
+            }
+            if (node.count > 0) {
+                size_t slot;
+                double t;
+                if (hit_block(origin, direction, node.first, ray_t, t, slot)) {
+                    hit_anything = true;
+                    ray_t.max = t;
+                    closest_slot = slot;
+                }
+                continue;
+            }
+            // push the far child first so the near one is popped next
+            uint32_t left = uint32_t(&node - nodes.data()) + 1;
+            uint32_t right = node.first;
+            if (inverse[node.axis] < 0) {
+                std::swap(left, right);
+            }
+            stack[stack_size++] = right;
+            stack[stack_size++] = left;
+        }
+
+        if (!hit_anything) {
+            return false;
+        }
+        rec.set_hit(this, ray_t.max, closest_slot);
+        return true;
+    }
+
+    void surface_interaction(const ray& r, entity_record& rec) const override {
+        size_t slot = rec.primitive_index;
+        point3 center(cx[slot], cy[slot], cz[slot]);
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / radius[slot];
+        rec.set_face_normal(r, outward_normal);
+        sphere::get_sphere_uv_coord(outward_normal, rec.u, rec.v);
+        sphere::get_sphere_uv_rate(outward_normal, radius[slot], rec.du_dl, rec.dv_dl);
+        rec.materials = (*materials)[material_index[slot]];
+    }
+
+private:
+    // Leaves have count > 0 and first is their block index. Interior nodes have count == 0, their
+    // left child directly follows them and first is the right child.
+    struct node {
+        axis_aligned_bounding_box bbox;
+        uint32_t first = 0;
+        uint8_t count = 0;
+        uint8_t axis = 0;
+    };
+
+    std::vector<node> nodes;
+    std::vector<double> cx, cy, cz, radius;
+    std::vector<uint32_t> material_index;
+    shared_ptr<const material_table> materials;
+
+    uint32_t build(const std::vector<point3>& centers, const std::vector<double>& radii,
+                   std::vector<uint32_t>& order, size_t start, size_t end) {
+        uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        auto bbox = axis_aligned_bounding_box::empty;
+        for (size_t i = start; i < end; i++) {
+            auto r = vec3(radii[order[i]], radii[order[i]], radii[order[i]]);
+            bbox = axis_aligned_bounding_box(bbox, axis_aligned_bounding_box(centers[order[i]] - r, centers[order[i]] + r));
+        }
+        nodes[index].bbox = bbox;
+
+        size_t len = end - start;
+        if (len <= size_t(lanes)) {
+            nodes[index].first = uint32_t(start);
+            nodes[index].count = uint8_t(len);
+            return index;
+        }
+
+        // split at the median center along the longest axis, rounded to whole blocks
+        int axis = bbox.longest_axis();
+        auto mid = start + std::max<size_t>(lanes, (len / 2) / lanes * lanes);
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+
+        nodes[index].axis = uint8_t(axis);
+        build(centers, radii, order, start, mid);
+        auto right = build(centers, radii, order, mid, end);
+        nodes[index].first = right;
+        return index;
+    }
+
+    // Intersects the four spheres of one leaf block, returning the closest root inside ray_t.
+    bool hit_block(const point3& origin, const vec3& direction, size_t block, const interval& ray_t,
+                   double& t, size_t& slot) const {
+        size_t base = block * lanes;
+        double4 ocx = double4(origin.x()) - double4::load(&cx[base]);
+        double4 ocy = double4(origin.y()) - double4::load(&cy[base]);
+        double4 ocz = double4(origin.z()) - double4::load(&cz[base]);
+        double4 r = double4::load(&radius[base]);
+
+        double4 dx(direction.x()), dy(direction.y()), dz(direction.z());
+        double4 a(direction.length_squared());
+        double4 half_b = ocx * dx + ocy * dy + ocz * dz;
+        double4 c = ocx * ocx + ocy * ocy + ocz * ocz - r * r;
+        double4 d = half_b * half_b - a * c;
+
+        double4 zero(0.0);
+        double4 has_roots = d >= zero;
+        double4 sqrt_d = sqrt(max(d, zero));
+        double4 t_min(ray_t.min), t_max(ray_t.max);
+
+        // nearest root first, falling back to the far root when the near one is out of range
+        double4 near_root = (-half_b - sqrt_d) / a;
+        double4 far_root = (-half_b + sqrt_d) / a;
+        double4 near_ok = (near_root > t_min) & (near_root < t_max);
+        double4 far_ok = (far_root > t_min) & (far_root < t_max);
+        double4 root = select(near_ok, near_root, far_root);
+        int mask = movemask(has_roots & (near_ok | far_ok));
+        if (mask == 0) {
+            return false;
+        }
+
+        alignas(32) double roots[lanes];
+        root.store(roots);
+        int best = -1;
+        for (int lane = 0; lane < lanes; lane++) {
+            if ((mask & (1 << lane)) && (best < 0 || roots[lane] < roots[best])) {
+                best = lane;
+            }
+        }
+        t = roots[best];
+        slot = base + best;
+        return true;
+    }
+};
+
+#endif //GRAPHICA_SPHERE_SET_H
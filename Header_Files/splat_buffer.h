@@ -0,0 +1,56 @@
+//
+// Created by Aryan Singh on 6/25/24.
+//
+
+#ifndef GRAPHICA_SPLAT_BUFFER_H
+#define GRAPHICA_SPLAT_BUFFER_H
+
+#include "color.h"
+#include <atomic>
+#include <memory>
+
+// Image that any number of render threads add to at once, for light that lands on pixels other
+// than the one a thread is rendering (paths traced from the lights and connected to the camera).
+// There are no locks: every channel of every pixel is an atomic double, and add() retries a
+// compare-and-swap until its sum goes in, so threads only ever wait on the few pixels they collide
+// on, and then only for one retry each.
+class splat_buffer {
+public:
+    splat_buffer(int width, int height)
+            : width(width), height(height), channels(new std::atomic<double>[size_t(width) * height * 3]) {
+        for (size_t i = 0; i < size_t(width) * height * 3; i++) {
+            channels[i].store(0.0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(int col, int row, const color& c) {
+        auto first = (size_t(row) * width + col) * 3;
+        for (int k = 0; k < 3; k++) {
+            add(channels[first + k], c[k]);
+        }
+    }
+
+    // Only meaningful once every thread that adds to the buffer has finished.
+    [[nodiscard]] color value(int col, int row) const {
+        auto first = (size_t(row) * width + col) * 3;
+        return color(channels[first].load(std::memory_order_relaxed),
+                     channels[first + 1].load(std::memory_order_relaxed),
+                     channels[first + 2].load(std::memory_order_relaxed));
+    }
+
+private:
+    int width, height;
+    std::unique_ptr<std::atomic<double>[]> channels;
+
+    static void add(std::atomic<double>& channel, double amount) {
+        if (amount == 0) {
+            return;
+        }
+        // a failed exchange reloads the current sum into expected
+        auto expected = channel.load(std::memory_order_relaxed);
+        while (!channel.compare_exchange_weak(expected, expected + amount, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+#endif //GRAPHICA_SPLAT_BUFFER_H
@@ -6,7 +6,7 @@
 #define GRAPHICA_TEXTURE_H
 
 #include <utility>
-#include "rtw_image.h"
+#include "image_store.h"
 #include "perlin.h"
 #include "constants.h"
 
@@ -15,6 +15,20 @@ public:
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3& p) const = 0;
+
+    // Average over a footprint of du by dv in uv space around (u, v), for lookups that know how
+    // much of the surface a ray covers. Textures without a filtered form sample the centre.
+    virtual color filtered_value(double u, double v, const point3& p, double du, double dv) const {
+        return value(u, v, p);
+    }
+
+    // colors[n] = value(0, 0, points[n]) for n < count, for callers that evaluate a solid texture
+    // at many points at once, e.g. baking it. Textures with a batched form override this.
+    virtual void solid_values(const point3* points, color* colors, size_t count) const {
+        for (size_t n = 0; n < count; n++) {
+            colors[n] = value(0, 0, points[n]);
+        }
+    }
 };
 
 class solid_color: public texture {
@@ -48,6 +62,18 @@ public:
         }
     }
 
+    [[nodiscard]] color filtered_value(double u, double v, const point3& p, double du, double dv) const override {
+        int x = int(floor(inv_scale * p.x()));
+        int y = int(floor(inv_scale * p.y()));
+        int z = int(floor(inv_scale * p.z()));
+
+        if ((x+y+z)%2 == 0) {
+            return even->filtered_value(u,v,p,du,dv);
+        } else {
+            return odd->filtered_value(u,v,p,du,dv);
+        }
+    }
+
 private:
     double inv_scale;
     shared_ptr<texture> even, odd;
@@ -55,27 +81,23 @@ private:
 
 class image_texture : public texture {
 public:
-    image_texture(const char* filename) : image(filename) {}
+    image_texture(const char* filename) : mips(image_store::load(filename)) {}
 
     color value(double u, double v, const point3& p) const override {
-        if (image.height() <= 0) {
+        return filtered_value(u, v, p, 0, 0);
+    }
+
+    color filtered_value(double u, double v, const point3& p, double du, double dv) const override {
+        if (mips->empty()) {
             return color(0,0,1); // no image so just return solid color
         }
 
         u = interval(0,1).bound_to(u);
         v = 1.0 - interval(0, 1).bound_to(v);
-
-        auto col = int(u * image.width());
-        auto row = int(v * image.height());
-        auto pixel_data = image.pixel_data(col, row);
-
-        auto scale = 1.0/255.0;
-        return color(pixel_data[0] * scale, pixel_data[1] * scale, pixel_data[2] * scale);
-
-
+        return mips->lookup(u, v, du, dv);
     }
 private:
-    rtw_image image;
+    shared_ptr<const mipmap> mips; // shared with every texture of the same file
 };
 
 class noise_texture: public texture {
@@ -87,6 +109,18 @@ public:
     color value(double u, double v, const point3& p) const override {
         return color(0.5, 0.5, 0.5) * (sin(noise.turbulence(p, 7) * 10 + scale * p.z()) + 1);
     }
+
+    void solid_values(const point3* points, color* colors, size_t count) const override {
+        const size_t batch = 64;
+        double turbulence[batch];
+        for (size_t first = 0; first < count; first += batch) {
+            auto n = std::min(batch, count - first);
+            noise.turbulence(points + first, turbulence, n, 7);
+            for (size_t i = 0; i < n; i++) {
+                colors[first + i] = color(0.5, 0.5, 0.5) * (sin(turbulence[i] * 10 + scale * points[first + i].z()) + 1);
+            }
+        }
+    }
 private:
     perlin noise;
     double scale;
@@ -0,0 +1,223 @@
+//
+// Created by Aryan Singh on 6/15/24.
+//
+
+#ifndef GRAPHICA_TRANSFORM_H
+#define GRAPHICA_TRANSFORM_H
+
+#include "constants.h"
+#include "entity.h"
+#include <stdexcept>
+
+// 3x4 affine matrix: a 3x3 linear part in the first three columns and a translation in the last.
+class affine {
+public:
+    real m[3][4];
+
+    affine() : m{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}} {}
+
+    static affine translation(const vec3& offset) {
+        affine a;
+        for (int i = 0; i < 3; i++) {
+            a.m[i][3] = offset[i];
+        }
+        return a;
+    }
+
+    static affine scaling(const vec3& factors) {
+        affine a;
+        for (int i = 0; i < 3; i++) {
+            a.m[i][i] = factors[i];
+        }
+        return a;
+    }
+
+    // Right-handed rotation by angle degrees about the x (0), y (1) or z (2) axis.
+    static affine rotation(int axis, double angle) {
+        auto radians = deg_to_rad(angle);
+        auto c = cos(radians);
+        auto s = sin(radians);
+        int i = (axis + 1) % 3;
+        int j = (axis + 2) % 3;
+        affine a;
+        a.m[i][i] = c;
+        a.m[i][j] = -s;
+        a.m[j][i] = s;
+        a.m[j][j] = c;
+        return a;
+    }
+
+    real determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+               - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+               + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // this * other: applies other first
+    affine operator*(const affine& other) const {
+        affine a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                a.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j];
+            }
+            a.m[i][3] += m[i][3];
+        }
+        return a;
+    }
+
+    point3 point(const point3& p) const {
+        return vector(p) + vec3(m[0][3], m[1][3], m[2][3]);
+    }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    affine inverse() const {
+        // inverse of the linear part from its cofactors, then undo the translation
+        affine a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                int i1 = (j + 1) % 3, i2 = (j + 2) % 3;
+                int j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+                a.m[i][j] = m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1];
+            }
+        }
+        auto det = m[0][0] * a.m[0][0] + m[0][1] * a.m[1][0] + m[0][2] * a.m[2][0];
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                a.m[i][j] /= det;
+            }
+        }
+        auto t = -a.vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int i = 0; i < 3; i++) {
+            a.m[i][3] = t[i];
+        }
+        return a;
+    }
+
+    // Linear part transposed, translation dropped. Applied to the inverse this gives the matrix
+    // that carries normals.
+    affine transposed_linear() const {
+        affine a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                a.m[i][j] = m[j][i];
+            }
+        }
+        return a;
+    }
+};
+
+// Places an entity in the scene through an arbitrary affine transform. Rays are carried into
+// object space with the inverse, hits come back with the matrix itself and normals with the
+// inverse transpose.
+//
+// Wrapping a transform in another transform folds both into one matrix when the outer one is
+// built, so a chain such as translate(rotate_y(rotate_x(obj))) costs a single matrix-vector pair
+// per ray no matter how deep it is.
+class transform : public instance {
+public:
+    transform(shared_ptr<entity> object, const affine& object_to_world) {
+        if (auto inner = dynamic_pointer_cast<transform>(object)) {
+            obj = inner->obj;
+            to_world_matrix = object_to_world * inner->to_world_matrix;
+        } else {
+            obj = std::move(object);
+            to_world_matrix = object_to_world;
+        }
+        // a hit record has room for only so many instances to map its hit back through
+        if (obj->instance_depth() >= entity_record::max_instance_depth) {
+            throw std::length_error("transform: instances nested deeper than entity_record::max_instance_depth");
+        }
+        to_object_matrix = to_world_matrix.inverse();
+        normal_matrix = to_object_matrix.transposed_linear();
+        volume_scale = fabs(to_world_matrix.determinant());
+
+        // bounding box of the eight transformed corners
+        auto box = obj->bounding_box();
+        point3 min(inf, inf, inf);
+        point3 max(-inf, -inf, -inf);
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                for (int k = 0; k < 2; k++) {
+                    point3 corner(i ? box.x.max : box.x.min, j ? box.y.max : box.y.min, k ? box.z.max : box.z.min);
+                    auto moved = to_world_matrix.point(corner);
+                    for (int component = 0; component < 3; component++) {
+                        min[component] = fmin(min[component], moved[component]);
+                        max[component] = fmax(max[component], moved[component]);
+                    }
+                }
+            }
+        }
+        bbox = axis_aligned_bounding_box(min, max);
+    }
+
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        // the direction is not renormalised, so t means the same thing in both spaces
+        if (!obj->hit(to_object(r), ray_t, rec)) {
+            return false;
+        }
+        rec.push_instance(this);
+        return true;
+    }
+
+    ray to_object(const ray& r) const override {
+        return ray(to_object_matrix.point(r.origin()), to_object_matrix.vector(r.direction()), r.time());
+    }
+
+    void to_world(entity_record& rec) const override {
+        rec.p = to_world_matrix.point(rec.p);
+        auto normal = normal_matrix.vector(rec.normal);
+        // a unit of surface area around p grows by det(M) |M^-T n|; its square root rescales the uv rates
+        auto stretch = sqrt(volume_scale * normal.length());
+        rec.du_dl /= stretch;
+        rec.dv_dl /= stretch;
+        rec.normal = unit_vector(normal);
+    }
+
+    [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
+        return bbox;
+    }
+
+    [[nodiscard]] int instance_depth() const override {
+        return 1 + obj->instance_depth();
+    }
+
+private:
+    shared_ptr<entity> obj;
+    affine to_world_matrix;
+    affine to_object_matrix;
+    affine normal_matrix;
+    real volume_scale;
+    axis_aligned_bounding_box bbox;
+};
+
+class translate : public transform {
+public:
+    translate(shared_ptr<entity> obj, const vec3& offset) : transform(std::move(obj), affine::translation(offset)) {}
+};
+
+class rotate_x : public transform {
+public:
+    rotate_x(shared_ptr<entity> obj, double angle) : transform(std::move(obj), affine::rotation(0, angle)) {}
+};
+
+class rotate_y : public transform {
+public:
+    rotate_y(shared_ptr<entity> obj, double angle) : transform(std::move(obj), affine::rotation(1, angle)) {}
+};
+
+class rotate_z : public transform {
+public:
+    rotate_z(shared_ptr<entity> obj, double angle) : transform(std::move(obj), affine::rotation(2, angle)) {}
+};
+
+class scale : public transform {
+public:
+    scale(shared_ptr<entity> obj, const vec3& factors) : transform(std::move(obj), affine::scaling(factors)) {}
+};
+
+#endif //GRAPHICA_TRANSFORM_H
@@ -0,0 +1,180 @@
+//
+// Created by Aryan Singh on 6/14/24.
+//
+
+// Watertight ray-triangle intersection (Woop, Benthin and Wald 2013) over triangles stored four at
+// a time in structure-of-arrays blocks. The ray is sheared once so that it points down +z, after
+// which every triangle edge test is a 2D cross product. Edges shared by two triangles are then
+// evaluated with identical inputs, so a ray can never slip through the crack between them. Blocks
+// hold doubles in the float build too.
+
+#ifndef GRAPHICA_TRIANGLE_SOA_H
+#define GRAPHICA_TRIANGLE_SOA_H
+
+#include "constants.h"
+#include "axis_aligned_bounding_box.h"
+#include "simd.h"
+#include <vector>
+
+// Per-ray setup shared by every triangle the ray is tested against.
+class watertight_ray {
+public:
+    int kx, ky, kz;     // axis permutation, kz is the dominant direction axis
+    double sx, sy, sz;  // shear constants
+    point3 origin;
+
+    explicit watertight_ray(const ray& r) : origin(r.origin()) {
+        const vec3& dir = r.direction();
+        kz = (fabs(dir.x()) > fabs(dir.y()))
+                ? (fabs(dir.x()) > fabs(dir.z()) ? 0 : 2)
+                : (fabs(dir.y()) > fabs(dir.z()) ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // keep the winding of the projected triangles consistent
+        if (dir[kz] < 0) {
+            std::swap(kx, ky);
+        }
+        sx = dir[kx] / dir[kz];
+        sy = dir[ky] / dir[kz];
+        sz = 1.0 / dir[kz];
+    }
+};
+
+// Closest intersection reported by triangle_soa. p = (1-b1-b2)*v0 + b1*v1 + b2*v2.
+struct triangle_hit {
+    double t;
+    size_t index;
+    double b1, b2;
+};
+
+class triangle_soa {
+public:
+    static const int lanes = 4;
+
+    // Returns the index of the added triangle.
+    size_t add(const point3& v0, const point3& v1, const point3& v2) {
+        size_t index = count++;
+        if (index % lanes == 0) {
+            blocks.emplace_back();
+        }
+        auto& b = blocks.back();
+        int lane = int(index % lanes);
+        const point3* v[3] = {&v0, &v1, &v2};
+        for (int k = 0; k < 3; k++) {
+            for (int axis = 0; axis < 3; axis++) {
+                b.v[k][axis][lane] = (*v[k])[axis];
+            }
+        }
+        bbox = axis_aligned_bounding_box(bbox, axis_aligned_bounding_box(v0, v1));
+        bbox = axis_aligned_bounding_box(bbox, axis_aligned_bounding_box(v1, v2));
+        return index;
+    }
+
+    size_t size() const { return count; }
+
+    // Leaves the rest of the current block empty so the next triangle starts a new block.
+    void pad_to_block() {
+        count = blocks.size() * lanes;
+    }
+
+    size_t block_count() const { return blocks.size(); }
+
+    point3 vertex(size_t index, int k) const {
+        const auto& b = blocks[index / lanes];
+        int lane = int(index % lanes);
+        return point3(b.v[k][0][lane], b.v[k][1][lane], b.v[k][2][lane]);
+    }
+
+    // Geometric normal following the winding v0 -> v1 -> v2, not normalised.
+    vec3 normal(size_t index) const {
+        auto v0 = vertex(index, 0);
+        return cross(vertex(index, 1) - v0, vertex(index, 2) - v0);
+    }
+
+    axis_aligned_bounding_box bounding_box() const { return bbox; }
+
+    bool hit(const ray& r, interval ray_t, triangle_hit& hit) const {
+        return hit_blocks(watertight_ray(r), ray_t, 0, blocks.size(), hit);
+    }
+
+    // Tests blocks [first, last) and keeps the closest hit inside ray_t. Used directly by BVH leaves
+    // that own a contiguous run of blocks so the ray setup is paid once.
+    bool hit_blocks(const watertight_ray& wr, interval ray_t, size_t first, size_t last, triangle_hit& hit) const {
+        bool hit_anything = false;
+        for (size_t i = first; i < last; i++) {
+            if (hit_block(wr, ray_t, i, hit)) {
+                hit_anything = true;
+                ray_t.max = hit.t;
+            }
+        }
+        return hit_anything;
+    }
+
+    bool hit_block(const watertight_ray& wr, const interval& ray_t, size_t block_index, triangle_hit& hit) const {
+        const auto& b = blocks[block_index];
+
+        double4 ox(wr.origin[wr.kx]), oy(wr.origin[wr.ky]), oz(wr.origin[wr.kz]);
+        double4 sx(wr.sx), sy(wr.sy), sz(wr.sz);
+
+        // vertices relative to the ray origin
+        double4 az = double4::load(b.v[0][wr.kz]) - oz;
+        double4 bz = double4::load(b.v[1][wr.kz]) - oz;
+        double4 cz = double4::load(b.v[2][wr.kz]) - oz;
+        double4 ax = double4::load(b.v[0][wr.kx]) - ox - sx * az;
+        double4 ay = double4::load(b.v[0][wr.ky]) - oy - sy * az;
+        double4 bx = double4::load(b.v[1][wr.kx]) - ox - sx * bz;
+        double4 by = double4::load(b.v[1][wr.ky]) - oy - sy * bz;
+        double4 cx = double4::load(b.v[2][wr.kx]) - ox - sx * cz;
+        double4 cy = double4::load(b.v[2][wr.ky]) - oy - sy * cz;
+
+        // scaled barycentrics, one per edge
+        double4 u = cx * by - cy * bx;
+        double4 v = ax * cy - ay * cx;
+        double4 w = bx * ay - by * ax;
+
+        double4 zero(0.0);
+        double4 any_negative = (u < zero) | (v < zero) | (w < zero);
+        double4 any_positive = (u > zero) | (v > zero) | (w > zero);
+
+        double4 det = u + v + w;
+        double4 scaled_t = u * (sz * az) + v * (sz * bz) + w * (sz * cz);
+        double4 t = scaled_t / det;
+
+        double4 valid = (det != zero) & (t > double4(ray_t.min)) & (t < double4(ray_t.max));
+        int mask = movemask(valid) & ~movemask(any_negative & any_positive);
+        if (mask == 0) {
+            return false;
+        }
+
+        alignas(32) double ts[lanes], vs[lanes], ws[lanes], dets[lanes];
+        t.store(ts);
+        v.store(vs);
+        w.store(ws);
+        det.store(dets);
+
+        int best = -1;
+        for (int lane = 0; lane < lanes; lane++) {
+            if ((mask & (1 << lane)) && (best < 0 || ts[lane] < ts[best])) {
+                best = lane;
+            }
+        }
+
+        hit.t = ts[best];
+        hit.index = block_index * lanes + best;
+        hit.b1 = vs[best] / dets[best];
+        hit.b2 = ws[best] / dets[best];
+        return true;
+    }
+
+private:
+    // v[vertex][axis][lane]; unused lanes stay zero, which gives det == 0 and never hits
+    struct block {
+        alignas(32) double v[3][3][lanes] = {};
+    };
+
+    std::vector<block> blocks;
+    size_t count = 0;
+    axis_aligned_bounding_box bbox = axis_aligned_bounding_box::empty;
+};
+
+#endif //GRAPHICA_TRIANGLE_SOA_H
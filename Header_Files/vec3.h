@@ -8,56 +8,79 @@
 #include <cmath>
 #include <iostream>
 
+// GRAPHICA_SIMD_VEC3 pads every vector to four lanes and runs the arithmetic below on float4 /
+// double4 registers instead of three scalars. Call sites are the same either way. Targets without
+// SSE2 or AVX keep the scalar layout, since the array fallback of simd.h would only add overhead.
+// It pays off in float; in double on SSE2, where a vector takes two registers, the element-wise
+// operators measured about twice as slow as scalar code (Benchmarks/vec3_bench.cpp).
+#ifdef GRAPHICA_SIMD_VEC3
+#include "simd.h"
+#endif
+
+#if defined(GRAPHICA_SIMD_VEC3) && (defined(GRAPHICA_SIMD_AVX) || defined(GRAPHICA_SIMD_SSE2))
+#define GRAPHICA_VEC3_PACKED 1
+#endif
 
 using std::sqrt;
 
-class vec3 {
+// Three-component vector templated on its scalar type. The renderer itself uses vec3, which is
+// vec3_t<real>; see constants.h for how real is chosen.
+template <typename T>
+class vec3_t {
 public:
-    double e[3];
-
-    vec3() : e{0,0,0} {}
-    vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
-
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
-
-    vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
-
-    vec3& operator+=(const vec3 &v) {
-        e[0] += v.e[0];
-        e[1] += v.e[1];
-        e[2] += v.e[2];
-        return *this;
+    using scalar = T;
+
+#ifdef GRAPHICA_VEC3_PACKED
+    // the register view keeps vectors in xmm/ymm registers between operations; lane 3 is always zero
+    union {
+        T e[4];
+        typename simd_pack<T>::type p;
+    };
+#else
+    T e[3];
+#endif
+
+    vec3_t() : e{0,0,0} {}
+    vec3_t(T e0, T e1, T e2) : e{e0, e1, e2} {}
+
+    // changing precision has to be asked for
+    template <typename U>
+    explicit vec3_t(const vec3_t<U>& v) : e{T(v[0]), T(v[1]), T(v[2])} {}
+
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
+
+    vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+    T operator[](int i) const { return e[i]; }
+    T& operator[](int i) { return e[i]; }
+
+    vec3_t& operator+=(const vec3_t &v) {
+        return *this = *this + v;
     }
 
-    vec3& operator*=(double t) {
-        e[0] *= t;
-        e[1] *= t;
-        e[2] *= t;
-        return *this;
+    vec3_t& operator*=(T t) {
+        return *this = t * *this;
     }
 
-    vec3& operator/=(double t) {
+    vec3_t& operator/=(T t) {
         return *this *= 1/t;
     }
 
-    double length() const {
+    T length() const {
         return sqrt(length_squared());
     }
 
-    double length_squared() const {
-        return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
+    T length_squared() const {
+        return dot(*this, *this);
     }
 
-    static vec3 random_vector() {
-        return vec3(random_double(), random_double(), random_double());
+    static vec3_t random_vector() {
+        return vec3_t(random_double(), random_double(), random_double());
     }
 
-    static vec3 random_vector(double min, double max) {
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+    static vec3_t random_vector(double min, double max) {
+        return vec3_t(random_double(min, max), random_double(min, max), random_double(min, max));
     }
 
     bool is_near_zero() const {
@@ -66,81 +89,121 @@ public:
     }
 };
 
+using vec3 = vec3_t<real>;
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
 using point3 = vec3;
 using color = vec3;
 
 
 // Vector Utility Functions
+// Scalars are taken as vec3_t<T>::scalar so that a double constant can scale a float vector.
 
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream &out, const vec3_t<T> &v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+#ifdef GRAPHICA_VEC3_PACKED
+
+template <typename T>
+inline typename simd_pack<T>::type as_pack(const vec3_t<T> &v) {
+    return v.p;
 }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline vec3_t<T> from_pack(typename simd_pack<T>::type p) {
+    vec3_t<T> v;
+    v.p = p;
+    return v;
 }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return from_pack<T>(as_pack(u) + as_pack(v));
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return from_pack<T>(as_pack(u) - as_pack(v));
 }
 
-inline vec3 operator*(const vec3 &v, double t) {
-    return t * v;
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return from_pack<T>(as_pack(u) * as_pack(v));
 }
 
-inline vec3 operator/(vec3 v, double t) {
-    return (1/t) * v;
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T> &v) {
+    return from_pack<T>(typename simd_pack<T>::type(t) * as_pack(v));
 }
 
-inline double dot(const vec3 &u, const vec3 &v) {
+template <typename T>
+inline T dot(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return sum3(as_pack(u) * as_pack(v));
+}
+
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T> &u, const vec3_t<T> &v) {
+    // lane i of the product is u[i]*v[i+1] - u[i+1]*v[i], i.e. component i+2 of the cross product
+    auto a = as_pack(u);
+    auto b = as_pack(v);
+    return from_pack<T>(yzx(a * yzx(b) - yzx(a) * b));
+}
+
+#else
+
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+}
+
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+}
+
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+}
+
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T> &v) {
+    return vec3_t<T>(t*v.e[0], t*v.e[1], t*v.e[2]);
+}
+
+template <typename T>
+inline T dot(const vec3_t<T> &u, const vec3_t<T> &v) {
     return u.e[0] * v.e[0]
            + u.e[1] * v.e[1]
            + u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T> &u, const vec3_t<T> &v) {
+    return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                     u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                     u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(vec3 v) {
-    return v / v.length();
-}
+#endif
 
-inline vec3 present_in_unit_sphere() {
-//    clog << "Reached inside present in unit sphere \n";
-    while (true) {
-        auto sampled_vector = vec3::random_vector(-1, 1);
-//        clog << sampled_vector.length_squared() << "\n";
-        if (sampled_vector.length_squared() < 1) {
-//            clog << "Exited inside present in unit sphere \n";
-            return sampled_vector;
-        }
-    }
+// Both backends divide by the exact length. rsqrt plus Newton-Raphson steps measured slower than
+// sqrt and a divide in either precision (Benchmarks/vec3_bench.cpp), besides being less accurate.
+template <typename T>
+inline vec3_t<T> unit_vector(vec3_t<T> v) {
+    return v / v.length();
 }
 
-inline vec3 normalize_vec_in_unit_sphere() {
-//    clog << "Reached inside unit sphere \n";
-    return unit_vector(present_in_unit_sphere());
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T> &v, typename vec3_t<T>::scalar t) {
+    return t * v;
 }
 
-inline vec3 check_orientation(const vec3& normal) {
-    vec3 unit_sphere_vector = normalize_vec_in_unit_sphere();
-    if (dot(unit_sphere_vector, normal) > 0.0) {
-        return unit_sphere_vector;
-    } else {
-        return -unit_sphere_vector;
-    }
+template <typename T>
+inline vec3_t<T> operator/(vec3_t<T> v, typename vec3_t<T>::scalar t) {
+    return (1/t) * v;
 }
 
 inline vec3 metal_reflect(const vec3& incidence, const vec3& normal) {
@@ -157,14 +220,4 @@ inline vec3 refract(const vec3& refracted, const vec3& normal, double refractive
     return refracted_perpendicular_component + refracted_parallel_component;
 }
 
-// for defocus blur cone -> Send rays from disk around camera center
-inline vec3 random_in_disk() {
-    while (true) {
-        auto generated = vec3(random_double(-1,1), random_double(-1, 1), 0);
-        if (generated.length_squared() < 1.0) {
-            return generated;
-        }
-    }
-}
-
 #endif //GRAPHICA_VEC3_H
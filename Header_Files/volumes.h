@@ -9,73 +9,44 @@
 #include "constants.h"
 #include "texture.h"
 #include "material.h"
+#include "medium.h"
 
+// Fills the inside of a closed boundary with a constant density medium. The boundary is hit like
+// any surface, once per ray, and its hits are marked with the medium as interior; the integrator
+// keeps track of which media a path is in and samples scattering along each segment. A
+// non-convex or nested boundary is therefore just more crossings.
+//
+// By default the boundary is invisible and rays pass straight through it. With
+// keep_surface the boundary keeps its own material, e.g. a glass shell around the medium.
 class volumes : public entity {
 public:
-    volumes(shared_ptr<entity> boundary, double density, shared_ptr<texture> textures)
-    : boundary(boundary), neg_density(-1.0/density), phase_function(make_shared<isotropic>(textures)) {}
+    volumes(shared_ptr<entity> boundary, double density, shared_ptr<texture> textures, bool keep_surface = false)
+    : boundary(boundary), interior(make_shared<homogeneous_medium>(density, textures)), keep_surface(keep_surface) {}
 
-    volumes(shared_ptr<entity> boundary, double density, const color& albedo)
-    : boundary(boundary), neg_density(-1.0/density), phase_function(make_shared<isotropic>(albedo)) {}
+    volumes(shared_ptr<entity> boundary, double density, const color& albedo, bool keep_surface = false)
+    : boundary(boundary), interior(make_shared<homogeneous_medium>(density, albedo)), keep_surface(keep_surface) {}
 
     [[nodiscard]] axis_aligned_bounding_box bounding_box() const override {
         return boundary->bounding_box();
     }
 
-    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
-        entity_record record1, record2;
-
-        if (!boundary->hit(r, interval::universe, record1)) {
-            return false;
-        }
-
-        auto epsilon = 0.0001;
-
-        if (!boundary->hit(r, interval(record1.t + epsilon, inf), record2)) {
-            return false;
-        }
-
-        // do simple conditional operator for faster time since fmin is slower
-        if (record1.t < ray_t.min) {
-//            ray_t.min = record1.t;
-            record1.t = ray_t.min;
-        }
-        if (record2.t > ray_t.max) {
-//            ray_t.max = record2.t;
-            record2.t = ray_t.max;
-
-        }
+    [[nodiscard]] int instance_depth() const override {
+        return boundary->instance_depth();
+    }
 
-        if (record2.t <= record1.t) {
+    bool hit(const ray& r, interval ray_t, entity_record& rec) const override {
+        if (!boundary->hit(r, ray_t, rec)) {
             return false;
         }
-
-        if (record1.t < 0) {
-            record1.t = 0;
-        }
-
-        auto length = r.direction().length();
-
-        auto dist_in_boundary = (record2.t-record1.t) * length;
-        auto hit_distance = neg_density * log(random_double()); // probability = C (neg_density) * delta(L)
-        if (hit_distance > dist_in_boundary) {
-            return false; // outside of boundary
-        }
-
-        rec.t = record1.t + hit_distance / length;
-        rec.p = r.at(rec.t);
-
-        rec.normal = vec3(1,0,0);
-        rec.front_face = true;
-        rec.materials = phase_function;
-
+        rec.interior = interior.get();
+        rec.pass_through = !keep_surface;
         return true;
     }
 
 private:
     shared_ptr<entity> boundary;
-    double neg_density;
-    shared_ptr<material> phase_function;
+    shared_ptr<medium> interior;
+    bool keep_surface;
 };
 
 #endif //GRAPHICA_VOLUMES_H
@@ -10,12 +10,34 @@
 #include "Header_Files/material.h"
 #include "Header_Files/pyramid.h"
 #include "Header_Files/volumes.h"
+#include "Header_Files/grid_volume.h"
 #include "Header_Files/bvh.h"
 #include "Header_Files/quadrilateral.h"
+#include "Header_Files/sphere_set.h"
+#include "Header_Files/transform.h"
+#include "Header_Files/heightfield.h"
+#include "Header_Files/baked_texture.h"
+#include <cstdlib>
 #include <iostream>
 
 using namespace std;
 
+// Image width and samples per pixel that replace every scene's own when given on the command
+// line, for quick previews and for comparing builds scene by scene (see
+// Benchmarks/compare_precision.sh). Zero keeps the scene's setting.
+int preview_width = 0;
+int preview_samples = 0;
+
+void render(camera& cam, const entity& world) {
+    if (preview_width > 0) {
+        cam.IMAGE_WIDTH = preview_width;
+    }
+    if (preview_samples > 0) {
+        cam.NUM_SAMPLES_PER_PIXELS = preview_samples;
+    }
+    cam.render(world);
+}
+
 void bouncing_spheres() {
     entity_list world;
 
@@ -78,7 +100,7 @@ void bouncing_spheres() {
     cam.FOCUS_DISTANCE    = 10.0;
     cam.BACKGROUND = color(0.70, 0.80, 1.00);
 
-    cam.render(world);
+    render(cam, world);
 }
 
 void checkered_spheres() {
@@ -104,7 +126,7 @@ void checkered_spheres() {
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0.70, 0.80, 1.00);
 
-    cam.render(world);
+    render(cam, world);
 }
 
 void earth() {
@@ -127,14 +149,17 @@ void earth() {
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0.70, 0.80, 1.00);
 
-    cam.render(entity_list(globe));
+    render(cam, entity_list(globe));
 }
 
 void perlin_spheres() {
     entity_list world;
     auto texture = make_shared<noise_texture>(4);
     world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(texture)));
-    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(texture)));
+    // the small sphere looks the noise up from a grid baked over its bounds instead
+    auto ball_bounds = axis_aligned_bounding_box(point3(-2,0,-2), point3(2,4,2));
+    auto baked = make_shared<baked_texture>(texture, ball_bounds, 128);
+    world.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(baked)));
 
     camera cam;
 
@@ -151,7 +176,7 @@ void perlin_spheres() {
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0.70, 0.80, 1.00);
 
-    cam.render(world);
+    render(cam, world);
 }
 
 void quads() {
@@ -185,7 +210,7 @@ void quads() {
 
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0.70, 0.80, 1.00);
-    cam.render(world);
+    render(cam, world);
 }
 
 void simple_light() {
@@ -214,7 +239,7 @@ void simple_light() {
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0,0,0);
 
-    cam.render(world);
+    render(cam, world);
 }
 
 void cornell_box() {
@@ -256,7 +281,7 @@ void cornell_box() {
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0,0,0);
 
-    cam.render(world);;
+    render(cam, world);
 }
 
 void cornell_smoke() {
@@ -269,7 +294,8 @@ void cornell_smoke() {
 
     world.add(make_shared<quadrilateral>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
     world.add(make_shared<quadrilateral>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quadrilateral>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light_source));
+    auto light = make_shared<quadrilateral>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light_source);
+    world.add(light);
     world.add(make_shared<quadrilateral>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
     world.add(make_shared<quadrilateral>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
     world.add(make_shared<quadrilateral>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
@@ -300,35 +326,91 @@ void cornell_smoke() {
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0,0,0);
 
-    cam.render(world);;
+    render(cam, world);
+}
+
+void cornell_grid_smoke() {
+    entity_list world;
+
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light_source = make_shared<diffuse_light>(color(7, 7, 7));
+
+    world.add(make_shared<quadrilateral>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_shared<quadrilateral>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(make_shared<quadrilateral>(point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light_source));
+    world.add(make_shared<quadrilateral>(point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quadrilateral>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quadrilateral>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    // a plume of smoke rising from the floor and widening with height, broken up by turbulence;
+    // most of its box is empty
+    const int resolution = 128;
+    auto region = axis_aligned_bounding_box(point3(60,0,60), point3(495,540,495));
+    perlin noise;
+    vector<float> densities(size_t(resolution) * resolution * resolution);
+    vector<point3> row(resolution);
+    vector<double> turbulence(resolution);
+    for (int k = 0; k < resolution; k++) {
+        for (int j = 0; j < resolution; j++) {
+            auto y = double(j) / (resolution - 1);
+            auto z = double(k) / (resolution - 1) - 0.5;
+            for (int i = 0; i < resolution; i++) {
+                row[i] = point3(i, j, k) * (6.0 / resolution);
+            }
+            noise.turbulence(row.data(), turbulence.data(), resolution, 5);
+            for (int i = 0; i < resolution; i++) {
+                auto x = double(i) / (resolution - 1) - 0.5;
+                auto radius = 0.12 + 0.3 * y;
+                auto falloff = 1 - (x * x + z * z) / (radius * radius);
+                auto density = falloff > 0 ? falloff * (0.2 + 2 * turbulence[i]) * (1 - y) : 0.0;
+                densities[(size_t(k) * resolution + j) * resolution + i] = float(density);
+            }
+        }
+    }
+    world.add(make_shared<grid_volume>(region, resolution, resolution, resolution, densities, 0.05,
+                                       color(0.9, 0.9, 0.9)));
+
+    camera cam;
+
+    cam.ASPECT_RATIO      = 1.0;
+    cam.IMAGE_WIDTH       = 600;
+    cam.NUM_SAMPLES_PER_PIXELS = 200;
+    cam.MAX_RECURSION_DEPTH         = 50;
+
+    cam.VERTICAL_POV     = 40;
+    cam.POV_OF_CAMERA = point3(278,278,-800);
+    cam.POV_OF_SCENE   = point3(278,278,0);
+    cam.UP = vec3(0,1,0);
+
+    cam.DEFOCUS_ANGLE = 0;
+    cam.BACKGROUND = color(0,0,0);
+
+    render(cam, world);
 }
 
 void final_scene(int image_width, int samples_per_pixel, int max_recursion) {
 
-    entity_list boxes1;
     auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
 
     int boxes_per_side = 20;
+    auto w = 100.0;
+    vector<real> heights(boxes_per_side * boxes_per_side);
     for (int i = 0; i < boxes_per_side; i++) {
         for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i*w;
-            auto z0 = -1000.0 + j*w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1,101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+            heights[j * boxes_per_side + i] = random_double(1,101);
         }
     }
 
     entity_list world;
 
-    world.add(make_shared<bvh>(boxes1));
+    world.add(make_shared<heightfield>(point3(-1000, 0, -1000), w, w, boxes_per_side, boxes_per_side,
+                                       heights, ground));
 
     auto light_source = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quadrilateral>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light_source));
+    auto light = make_shared<quadrilateral>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light_source);
+    world.add(light);
 
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30,0,0);
@@ -340,27 +422,28 @@ void final_scene(int image_width, int samples_per_pixel, int max_recursion) {
             point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
     ));
 
+    // the glass ball is the boundary of the blue medium, so both cost one intersection
     auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<volumes>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0,0,0), 5000, make_shared<dielectric>(1.5));
-    world.add(make_shared<volumes>(boundary, .0001, color(1,1,1)));
+    world.add(make_shared<volumes>(boundary, 0.2, color(0.2, 0.4, 0.9), true));
 
     auto emat = make_shared<lambertian>(make_shared<image_texture>("./image_textures/earthmap.jpg"));
     world.add(make_shared<sphere>(point3(400,200,400), 100, emat));
     auto pertext = make_shared<noise_texture>(0.2);
     world.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
 
-    entity_list boxes2;
     auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto cluster_materials = make_shared<material_table>();
+    auto white_id = cluster_materials->add(white);
     int ns = 1000;
+    vector<point3> centers;
     for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(point3::random_vector(0,165), 10, white));
+        centers.push_back(point3::random_vector(0,165));
     }
+    auto cluster = make_shared<sphere_set>(centers, vector<double>(ns, 10), vector<uint32_t>(ns, white_id),
+                                           cluster_materials);
 
     world.add(make_shared<translate>(
-                      make_shared<rotate_y>(
-                              make_shared<bvh>(boxes2), 15),
+                      make_shared<rotate_y>(cluster, 15),
                       vec3(-100,270,395)
               )
     );
@@ -380,8 +463,10 @@ void final_scene(int image_width, int samples_per_pixel, int max_recursion) {
 
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0,0,0);
+    // thin haze through the whole scene
+    cam.GLOBAL_MEDIUM = make_shared<homogeneous_medium>(.0001, color(1,1,1));
 
-    cam.render(world);;
+    render(cam, world);
 }
 
 void cornell_stratified() {
@@ -430,11 +515,126 @@ void cornell_stratified() {
     cam.DEFOCUS_ANGLE = 0;
     cam.BACKGROUND = color(0,0,0);
 
-    cam.render(world);;
+    render(cam, world);
+}
+
+void environment_spheres() {
+    entity_list world;
+
+    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(color(.5, .5, .5))));
+    world.add(make_shared<sphere>(point3(-2.2,1,0), 1, make_shared<lambertian>(color(.7, .3, .2))));
+    world.add(make_shared<sphere>(point3(0,1,0), 1, make_shared<rough_conductor>(color(.9, .8, .6), 0.3)));
+    world.add(make_shared<sphere>(point3(2.2,1,0), 1, make_shared<rough_dielectric>(1.5, 0.1)));
+
+    camera cam;
+
+    cam.ASPECT_RATIO      = 16.0 / 9.0;
+    cam.IMAGE_WIDTH       = 400;
+    cam.NUM_SAMPLES_PER_PIXELS = 100;
+    cam.MAX_RECURSION_DEPTH         = 50;
+
+    cam.VERTICAL_POV     = 35;
+    cam.POV_OF_CAMERA = point3(0,2,9);
+    cam.POV_OF_SCENE   = point3(0,1,0);
+    cam.UP = vec3(0,1,0);
+
+    cam.DEFOCUS_ANGLE = 0;
+    // any latitude-longitude image lights the scene; an HDR capture (.hdr) keeps its full range
+    cam.ENVIRONMENT = make_shared<environment_light>("./image_textures/earthmap.jpg");
+
+    render(cam, world);
+}
+void many_lights() {
+    entity_list world;
+
+    world.add(make_shared<quadrilateral>(point3(-50,0,-50), vec3(100,0,0), vec3(0,0,100),
+                                         make_shared<lambertian>(color(.6, .6, .6))));
+    world.add(make_shared<sphere>(point3(-3,1.5,0), 1.5, make_shared<lambertian>(color(.7, .3, .2))));
+    world.add(make_shared<sphere>(point3(0,1.5,0), 1.5, make_shared<rough_conductor>(color(.9, .9, .9), 0.2)));
+    world.add(make_shared<sphere>(point3(3,1.5,0), 1.5, make_shared<lambertian>(color(.2, .3, .7))));
+
+    // a field of small colored lamps, alternately bulbs and downward facing panels
+    for (int i = 0; i < 20; i++) {
+        for (int j = 0; j < 20; j++) {
+            auto x = -19.0 + 2 * i + 0.5 * random_double();
+            auto z = -19.0 + 2 * j + 0.5 * random_double();
+            auto glow = make_shared<diffuse_light>(8 * color::random_vector(0.2, 1));
+            if ((i + j) % 2 == 0) {
+                world.add(make_shared<sphere>(point3(x, 4 + random_double(), z), 0.1, glow));
+            } else {
+                world.add(make_shared<quadrilateral>(point3(x, 5, z), vec3(0,0,0.3), vec3(0.3,0,0), glow));
+            }
+        }
+    }
+
+    camera cam;
+
+    cam.ASPECT_RATIO      = 16.0 / 9.0;
+    cam.IMAGE_WIDTH       = 400;
+    cam.NUM_SAMPLES_PER_PIXELS = 64;
+    cam.MAX_RECURSION_DEPTH         = 10;
+
+    cam.VERTICAL_POV     = 40;
+    cam.POV_OF_CAMERA = point3(0,3,12);
+    cam.POV_OF_SCENE   = point3(0,1.5,0);
+    cam.UP = vec3(0,1,0);
+
+    cam.DEFOCUS_ANGLE = 0;
+    cam.BACKGROUND = color(0,0,0);
+
+    render(cam, world);
+}
+void cornell_caustics() {
+    entity_list world;
+
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light_source = make_shared<diffuse_light>(color(15, 15, 15));
+
+    world.add(make_shared<quadrilateral>(point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_shared<quadrilateral>(point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(make_shared<quadrilateral>(point3(343, 554, 332), vec3(-130,0,0), vec3(0,0,-105), light_source));
+    world.add(make_shared<quadrilateral>(point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quadrilateral>(point3(555,555,555), vec3(-555,0,0), vec3(0,0,-555), white));
+    world.add(make_shared<quadrilateral>(point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    // the light focused through the glass ball and off the mirror one is only found from the light
+    world.add(make_shared<sphere>(point3(190,90,190), 90, make_shared<dielectric>(1.5)));
+    world.add(make_shared<sphere>(point3(380,90,300), 90, make_shared<metal>(color(.8, .85, .88), 0.0)));
+
+    camera cam;
+
+    cam.ASPECT_RATIO      = 1.0;
+    cam.IMAGE_WIDTH       = 600;
+    cam.NUM_SAMPLES_PER_PIXELS = 200;
+    cam.MAX_RECURSION_DEPTH         = 10;
+    cam.BIDIRECTIONAL = true;
+
+    cam.VERTICAL_POV     = 40;
+    cam.POV_OF_CAMERA = point3(278,278,-800);
+    cam.POV_OF_SCENE   = point3(278,278,0);
+    cam.UP = vec3(0,1,0);
+
+    cam.DEFOCUS_ANGLE = 0;
+    cam.BACKGROUND = color(0,0,0);
+
+    render(cam, world);
 }
-int main() {
 
-    switch(7) {
+// Graphica [scene [image_width samples_per_pixel [seed]]] renders one of the scenes below,
+// cornell_box by default, to standard output.
+int main(int argc, char** argv) {
+    int scene = argc > 1 ? atoi(argv[1]) : 7;
+    if (argc > 3) {
+        preview_width = atoi(argv[2]);
+        preview_samples = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        SeedRng(unsigned(atoi(argv[4])));
+    }
+
+    switch(scene) {
         case 1: bouncing_spheres(); break;
         case 2: checkered_spheres(); break;
         case 3: earth(); break;
@@ -444,6 +644,10 @@ int main() {
         case 7: cornell_box(); break;
         case 8: cornell_smoke(); break;
         case 9: final_scene(800, 10000, 40); break;
+        case 10: cornell_grid_smoke(); break;
+        case 11: environment_spheres(); break;
+        case 12: many_lights(); break;
+        case 13: cornell_caustics(); break;
         default:
             final_scene(800, 500, 4); break;
     }
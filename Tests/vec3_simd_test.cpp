@@ -0,0 +1,216 @@
+//
+// Created by Aryan Singh on 6/25/24.
+//
+
+// Checks the SIMD vec3 backend (GRAPHICA_SIMD_VEC3) against the scalar one, in float and double,
+// on random vectors over a wide range of magnitudes and on edge cases: zeros, signed zeros, axis
+// and parallel vectors, values whose squares leave the single precision range, infinities and
+// NaN. The scalar backend is restated below as the reference, since a translation unit can only
+// use one of the two.
+//
+// Element-wise operators and unit_vector must match bit for bit, dot and cross to within the
+// rounding of their sums (the same order of operations gives the same bits, contracted
+// multiply-adds may not). simd.h's rsqrt is checked against 1/sqrt to within the error its
+// Newton-Raphson refinement leaves.
+
+#ifndef GRAPHICA_SIMD_VEC3
+#define GRAPHICA_SIMD_VEC3
+#endif
+
+#include "Header_Files/constants.h"
+#include <cstdio>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+int failures = 0;
+int checks = 0;
+
+template <typename T>
+struct reference {
+    T e[3];
+
+    reference(const vec3_t<T>& v) : e{v[0], v[1], v[2]} {}
+    reference(T x, T y, T z) : e{x, y, z} {}
+};
+
+template <typename T> reference<T> add(const reference<T>& u, const reference<T>& v) {
+    return {u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]};
+}
+template <typename T> reference<T> subtract(const reference<T>& u, const reference<T>& v) {
+    return {u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]};
+}
+template <typename T> reference<T> negate(const reference<T>& v) {
+    return {-v.e[0], -v.e[1], -v.e[2]};
+}
+template <typename T> reference<T> multiply(const reference<T>& u, const reference<T>& v) {
+    return {u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]};
+}
+template <typename T> reference<T> scale(T t, const reference<T>& v) {
+    return {t * v.e[0], t * v.e[1], t * v.e[2]};
+}
+template <typename T> T dot(const reference<T>& u, const reference<T>& v) {
+    return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
+}
+template <typename T> reference<T> cross(const reference<T>& u, const reference<T>& v) {
+    return {u.e[1] * v.e[2] - u.e[2] * v.e[1],
+            u.e[2] * v.e[0] - u.e[0] * v.e[2],
+            u.e[0] * v.e[1] - u.e[1] * v.e[0]};
+}
+template <typename T> reference<T> unit_vector(const reference<T>& v) {
+    return scale(T(1) / sqrt(dot(v, v)), v);
+}
+
+// Relative error allowed for each result: bit-exact ones get none.
+template <typename T> struct tolerance;
+template <> struct tolerance<double> {
+    static constexpr double sum = 2 * numeric_limits<double>::epsilon();
+    // a step takes error e to 1.5 e^2: 1.5 * 2^-12 -> 2.0e-7 -> 6.1e-14, then the final multiply
+    static constexpr double rsqrt = 6.2e-14;
+};
+template <> struct tolerance<float> {
+    static constexpr double sum = 2 * numeric_limits<float>::epsilon();
+    // one step: 1.5 * 2^-12 -> 2.0e-7, plus the rounding of the step and the multiply
+    static constexpr double rsqrt = 4 * numeric_limits<float>::epsilon();
+};
+
+// Within relative * scale of each other; NaN only matches NaN, and bit-exact results (relative 0)
+// must agree in the sign of zero too.
+template <typename T>
+bool same(T a, T b, double relative, double scale) {
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::isnan(a) && std::isnan(b);
+    }
+    if (relative == 0) {
+        return memcmp(&a, &b, sizeof(T)) == 0;
+    }
+    if (a == b) {
+        return true;
+    }
+    return std::isfinite(scale) && fabs(double(a) - double(b)) <= relative * scale;
+}
+
+template <typename T>
+void check(const char* what, const vec3_t<T>& u, const vec3_t<T>& v, T expected, T actual,
+           double relative, double scale, int component = 0) {
+    checks++;
+    if (!same(actual, expected, relative, scale) && failures++ < 20) {
+        printf("FAIL %s<%s> u=(%g %g %g) v=(%g %g %g) component %d: %.17g, expected %.17g\n", what,
+               sizeof(T) == 4 ? "float" : "double", double(u[0]), double(u[1]), double(u[2]),
+               double(v[0]), double(v[1]), double(v[2]), component, double(actual), double(expected));
+    }
+}
+
+template <typename T>
+void check(const char* what, const vec3_t<T>& u, const vec3_t<T>& v, const reference<T>& expected,
+           const vec3_t<T>& actual, double relative, double scale) {
+    for (int i = 0; i < 3; i++) {
+        check(what, u, v, expected.e[i], actual[i], relative, scale, i);
+    }
+}
+
+template <typename T>
+void check_pair(const vec3_t<T>& u, const vec3_t<T>& v) {
+    reference<T> ru(u), rv(v);
+    auto s = v[1];
+
+    check("operator+", u, v, add(ru, rv), u + v, 0, 0);
+    check("operator-", u, v, subtract(ru, rv), u - v, 0, 0);
+    check("negation", u, v, negate(ru), -u, 0, 0);
+    check("operator*", u, v, multiply(ru, rv), u * v, 0, 0);
+    check("scalar*", u, v, scale(s, ru), s * u, 0, 0);
+    check("*scalar", u, v, scale(s, ru), u * s, 0, 0);
+    check("operator/", u, v, scale(T(1) / s, ru), u / s, 0, 0);
+    auto sum = u;
+    sum += v;
+    check("operator+=", u, v, add(ru, rv), sum, 0, 0);
+
+    // rounding of a sum of products is relative to the size of the products, not of the result
+    auto magnitude = fabs(double(u[0]) * v[0]) + fabs(double(u[1]) * v[1]) + fabs(double(u[2]) * v[2]);
+    check("dot", u, v, dot(ru, rv), dot(u, v), tolerance<T>::sum, magnitude);
+    auto cross_magnitude = 0.0;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            cross_magnitude = fmax(cross_magnitude, fabs(double(u[i]) * v[j]));
+        }
+    }
+    check("cross", u, v, cross(ru, rv), cross(u, v), tolerance<T>::sum, 2 * cross_magnitude);
+    check("length_squared", u, v, dot(ru, ru), u.length_squared(), tolerance<T>::sum, dot(ru, ru));
+    check("unit_vector", u, v, unit_vector(ru), unit_vector(u), 0, 0);
+}
+
+// rsqrt of every lane, over the float range it is valid in
+template <typename T>
+void check_rsqrt(T x) {
+    T lanes[4];
+    rsqrt(typename simd_pack<T>::type(x)).store(lanes);
+    auto expected = 1 / sqrt(double(x));
+    for (int i = 0; i < 4; i++) {
+        checks++;
+        if (!same(double(lanes[i]), expected, tolerance<T>::rsqrt, expected) && failures++ < 20) {
+            printf("FAIL rsqrt<%s> x=%.9g lane %d: %.17g, expected %.17g\n", sizeof(T) == 4 ? "float" : "double",
+                   double(x), i, double(lanes[i]), expected);
+        }
+    }
+}
+
+template <typename T>
+vector<vec3_t<T>> edge_cases() {
+    const T big = sizeof(T) == 4 ? T(1e19) : T(1e200);
+    const T small = sizeof(T) == 4 ? T(1e-19) : T(1e-200);
+    const T inf = numeric_limits<T>::infinity();
+    const T nan = numeric_limits<T>::quiet_NaN();
+    return {
+        {0, 0, 0}, {-T(0), T(0), -T(0)}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {-1, 0, 0},
+        {1, 1, 1}, {2, 2, 2}, {-3, 6, -9}, {1, 2, 3},
+        // squared lengths beyond float range
+        {big, big, -big}, {small, -small, small}, {T(1e19), 0, 0}, {T(1e-25), T(2e-25), 0},
+        {T(3e18), T(4e18), 0}, {T(3e-18), T(4e-18), 0},
+        {inf, 0, 0}, {0, -inf, 1}, {nan, 1, 2}, {1, nan, 0},
+        {numeric_limits<T>::min(), 0, 0}, {numeric_limits<T>::max() / 4, 1, 1},
+    };
+}
+
+template <typename T>
+void run(const char* name) {
+    int before = checks, failed_before = failures;
+    auto cases = edge_cases<T>();
+    for (const auto& u : cases) {
+        for (const auto& v : cases) {
+            check_pair(u, v);
+        }
+    }
+    // random vectors spread over magnitudes from 1e-12 to 1e12, and pairs that are nearly parallel
+    for (int i = 0; i < 100000; i++) {
+        auto magnitude = [] { return T(pow(10.0, random_double(-12, 12))); };
+        vec3_t<T> u(T(random_double(-1, 1)), T(random_double(-1, 1)), T(random_double(-1, 1)));
+        vec3_t<T> v(T(random_double(-1, 1)), T(random_double(-1, 1)), T(random_double(-1, 1)));
+        u *= magnitude();
+        v = i % 4 == 0 ? T(1.0001) * u : magnitude() * v;
+        check_pair(u, v);
+        check_rsqrt(T(pow(10.0, random_double(-30, 30))));
+    }
+    for (T x : {T(1), T(4), T(0.25), T(1e-30), T(1e30), T(numeric_limits<float>::min()), T(3.0e38)}) {
+        check_rsqrt(x);
+    }
+    printf("%s: %d checks, %d failed\n", name, checks - before, failures - failed_before);
+}
+
+} // namespace
+
+int main() {
+    SeedRng(1);
+#if defined(GRAPHICA_VEC3_PACKED) && defined(GRAPHICA_SIMD_AVX)
+    printf("packed vec3 backend, AVX\n");
+#elif defined(GRAPHICA_VEC3_PACKED)
+    printf("packed vec3 backend, SSE2\n");
+#else
+    printf("no SSE2 or AVX: the SIMD option keeps the scalar layout, checking that\n");
+#endif
+    run<double>("double");
+    run<float>("float");
+    return failures == 0 ? 0 : 1;
+}